@@ -44,6 +44,20 @@ WORD peek_w(MEM_ADDR addr);
 LONG peek_l(MEM_ADDR addr);
 
 
+/*=====>>> stack.c <<<======================================================*/
+
+#define STACK_POOL_BASE (1024*1024)
+#define STACK_CANARY 0x5a5aa5a5
+
+MEM_ADDR alloc_stack(int size);
+void free_stack(MEM_ADDR addr);
+int stack_block_size(MEM_ADDR addr);
+void fill_stack_canary(MEM_ADDR bottom, MEM_ADDR top);
+BOOL clean_stacks_job(void* data);
+int stack_high_water(MEM_ADDR bottom, int size);
+void init_stacks();
+
+
 /*=====>>> window.c <<<=====================================================*/
 
 #define TAB_SIZE 4
@@ -52,16 +66,31 @@ LONG peek_l(MEM_ADDR addr);
 #define WINDOW_TOTAL_HEIGHT 25
 #define WINDOW_OFFSET(in_wnd, in_x, in_y) (((in_wnd)->y + (in_y)) * WINDOW_TOTAL_WIDTH + ((in_wnd)->x + (in_x)))
 
+#define WINDOW_DEFAULT_ATTR 0x0F
+
+/*
+ * style is the attribute (background << 4 | foreground) of the window,
+ * attr the one it writes with now. 0 means style for attr and
+ * WINDOW_DEFAULT_ATTR for style, so windows that do not set them are
+ * bright white on black.
+ */
 typedef struct {
   int  x, y;
   int  width, height;
   int  cursor_x, cursor_y;
   char cursor_char;
+  unsigned char style;
+  unsigned char attr;
 } WINDOW;
 
 extern WINDOW* kernel_window;
+extern BOOL console_deferred;
+extern BOOL console_panning;
 
 
+void flush_console();
+void console_tick();
+void reset_console_origin();
 void move_cursor(WINDOW* wnd, int x, int y);
 void remove_cursor(WINDOW* wnd);
 void show_cursor(WINDOW* wnd);
@@ -72,6 +101,8 @@ void output_string(WINDOW* wnd, const char *str);
 void wprintf(WINDOW* wnd, const char* fmt, ...);
 void kprintf(const char* fmt, ...);
 int k_sprintf(char *str, const char *fmt, ...);
+int k_vsnprintf(char *buf, int size, const char *fmt, va_list argp);
+int k_snprintf(char *buf, int size, const char *fmt, ...);
 
 
 /*=====>>> process.c <<<====================================================*/
@@ -79,7 +110,22 @@ int k_sprintf(char *str, const char *fmt, ...);
 /*
  * Max. number of processes
  */
-#define MAX_PROCS		20
+#define MAX_PROCS		256
+
+
+/*
+ * Max. number of ports, shared by all processes. A process may own
+ * any number of them.
+ */
+#define MAX_PORTS		(MAX_PROCS * 2)
+
+
+/*
+ * Stack sizes. Stacks are taken from the stack pool (see stack.c),
+ * so small processes such as notifiers should ask for a small one.
+ */
+#define DEFAULT_STACK_SIZE	(30*1024)
+#define SMALL_STACK_SIZE	(4*1024)
 
 
 /*
@@ -94,6 +140,7 @@ int k_sprintf(char *str, const char *fmt, ...);
 #define STATE_RECEIVE_BLOCKED	3
 #define STATE_MESSAGE_BLOCKED	4
 #define STATE_INTR_BLOCKED 	5
+#define NUM_STATES		6
 
 
 #define MAGIC_PCB 0x4321dcba
@@ -105,6 +152,26 @@ typedef struct _PCB* PROCESS;
 struct _PORT_DEF;
 typedef struct _PORT_DEF* PORT;
 
+/*
+ * A set of ports with one bit per entry of port[]. Used for
+ * receive_select() and for the ports of a process that have messages
+ * waiting. pop_message() keeps one bit per word in a summary word, so
+ * there can be at most 32 words.
+ */
+#define PORT_SET_WORDS		(MAX_PORTS / 32)
+
+typedef struct _PORT_SET {
+    unsigned       word[PORT_SET_WORDS];
+} PORT_SET;
+
+typedef struct _PROC_STATS {
+    unsigned       cpu_ticks;        /* Timer ticks it was running */
+    unsigned       dispatches;       /* Times it got the CPU */
+    unsigned       voluntary;        /* Lost the CPU blocking or resigning */
+    unsigned       preempted;        /* Lost the CPU while ready */
+    unsigned       state_ticks[NUM_STATES]; /* Ticks off the CPU per state */
+} PROC_STATS;
+
 typedef struct _PCB {
     unsigned       magic;
     unsigned       used;
@@ -118,6 +185,33 @@ typedef struct _PCB {
     PROCESS        next;
     PROCESS        prev;
     char*          name;
+    BOOL           on_ready_queue;
+    MEM_ADDR       stack_base;
+    unsigned       stack_size;
+    int            param_len;        /* Length of param_data, 0 if unknown */
+    void*          recv_buf;         /* Buffer passed to receive_copy() */
+    int            recv_buf_len;
+    PORT           param_port;       /* Port the last message came in on */
+    PORT_SET       ports_ready;      /* Open ports with messages */
+    unsigned       ports_ready_words; /* Words of ports_ready not 0 */
+    int            ports_pending;    /* Ports with messages, also closed */
+    PORT_SET*      ports_receiving;  /* Ports receive blocked on, NULL
+                                        for all */
+    unsigned short base_priority;    /* Priority without inheritance */
+    PROCESS        server;           /* Owner of the inheriting port this
+                                        process is send or reply blocked on */
+    unsigned short lenders[MAX_READY_QUEUES]; /* Processes with this as
+                                        server, by their priority */
+    PROC_STATS     stats;
+    unsigned short stats_state;      /* State whose ticks are being counted */
+    unsigned       stats_since;      /* _TOS_time when it entered stats_state */
+    PORT           blocked_on;       /* Port whose blocked list it is on */
+    PROCESS        reply_from;       /* Receiver of its send() */
+    BOOL           ipc_failed;       /* Peer died while it was blocked */
+    int            cpu;              /* CPU running it, -1 if none (SMP) */
+    int            lock_depth;       /* Kernel lock nesting while switched
+                                        out (SMP) */
+    unsigned       generation;       /* Times this PCB was allocated */
 } PCB;
 
 
@@ -133,9 +227,15 @@ PORT create_process(void (*new_proc) (PROCESS, PARAM),
 		    int prio,
 		    PARAM param,
 		    char *proc_name);
-#ifdef XXX
+PORT create_process_stack(void (*new_proc) (PROCESS, PARAM),
+			  int prio,
+			  PARAM param,
+			  char *proc_name,
+			  int stack_size);
+PROCESS alloc_process(int prio, char *name, int stack_size);
 PROCESS fork();
-#endif
+PROCESS fork_context();
+PROCESS fork_process(MEM_ADDR context);
 BOOL kill_process (PROCESS proc, BOOL force);
 PROCESS get_proc_by_name(char *name);
 void exit();
@@ -148,32 +248,70 @@ void init_process();
 
 /*=====>>> dispatch.c <<<===================================================*/
 
+#ifdef SMP
+/* one process per CPU, see smp.c */
+#define active_proc	current_proc()
+#else
 extern PROCESS active_proc;
+#endif
 extern PCB* ready_queue[];
+extern unsigned ready_mask;
+
+/* Index of the most significant set bit of a non-zero mask */
+#define HIGHEST_BIT(mask, bit)	asm ("bsrl %1, %0" : "=r" (bit) : "rm" (mask))
 
 PROCESS dispatcher();
 void add_ready_queue (PROCESS proc);
 void remove_ready_queue (PROCESS proc);
+void set_priority (PROCESS proc, int prio);
+void init_proc_stats (PROCESS proc);
+void account_switch (PROCESS from, PROCESS to, BOOL voluntary);
+void get_proc_stats (PROCESS proc, PROC_STATS* stats);
 void resign();
 void init_dispatcher();
 
 
 /*=====>>> null.c <<<=======================================================*/
 
-extern volatile unsigned int null_prime;
-extern volatile BOOL prime_reset;
-extern volatile unsigned int new_start;
+#define MAX_IDLE_JOBS	8
+
+/* Does a small amount of work, returns FALSE when there is no more */
+typedef BOOL (*IDLE_JOB) (void* data);
 
-extern volatile PROCESS process_to_kill;
+extern volatile unsigned int null_prime;
 
+void add_reap_queue(PROCESS proc);
+void remove_reap_queue(PROCESS proc);
+void add_idle_job(IDLE_JOB job, void* data);
+void kick_idle_job(IDLE_JOB job);
+void find_prime(unsigned int start);
 void init_null_process();
 
 /*=====>>> ipc.c <<<========================================================*/
 
-#define MAX_PORTS	(MAX_PROCS * 2)
-
 #define MAGIC_PORT  0x1234abcd
 
+/*
+ * A port with a mailbox buffers up to MAILBOX_SIZE messages sent with
+ * message(), so the sender does not have to wait for the receiver.
+ */
+#define MAX_MAILBOXES	16
+#define MAILBOX_SIZE	16
+
+typedef struct _MAILBOX {
+    BOOL      used;
+    BOOL      drop_when_full;    /* Drop messages instead of blocking */
+    int       head;              /* Index of oldest message */
+    int       depth;             /* Number of messages in the ring */
+    int       max_depth;         /* Largest depth seen */
+    unsigned  drops;             /* Messages dropped because of a full ring */
+    PROCESS   sender[MAILBOX_SIZE];
+    void*     data[MAILBOX_SIZE];
+    int       len[MAILBOX_SIZE];
+} MAILBOX;
+
+extern MAILBOX mailbox[];
+
 typedef struct _PORT_DEF {
     unsigned  magic;
     unsigned  used;              /* Port slot used? */
@@ -182,30 +320,61 @@ typedef struct _PORT_DEF {
     PROCESS   blocked_list_head; /* First local blocked process */
     PROCESS   blocked_list_tail; /* Last local blocked process */
     struct _PORT_DEF *next;            /* Next port */
+    MAILBOX*  mailbox;           /* Message ring, NULL for rendezvous only */
+    BOOL      pending;           /* Messages waiting, open or not */
+    BOOL      inherit_priority;  /* Owner inherits priority of senders */
 } PORT_DEF;
 
 extern PORT_DEF port[];
 
+/*
+ * Building a PORT_SET for receive_select()
+ */
+#define PORT_SET_WORD(p)	(((p) - port) >> 5)
+#define PORT_SET_BIT(p)		(1 << (((p) - port) & 31))
+
+#define PORT_SET_CLEAR(set)	k_memset(&(set), 0, sizeof(PORT_SET))
+#define PORT_SET_ADD(set, p)	((set).word[PORT_SET_WORD(p)] |= PORT_SET_BIT(p))
+#define PORT_SET_REMOVE(set, p)	((set).word[PORT_SET_WORD(p)] &= ~PORT_SET_BIT(p))
+#define PORT_SET_HAS(set, p)	(((set).word[PORT_SET_WORD(p)] & PORT_SET_BIT(p)) != 0)
+
 PORT create_port();
 PORT create_new_port (PROCESS proc);
 void remove_ports (PROCESS owner);
+void release_ipc (PROCESS proc);
 BOOL check_messages (PROCESS proc);
+void create_mailbox (PORT port, BOOL drop_when_full);
+void set_port_inheritance (PORT port, BOOL on);
 void open_port (PORT port);
 void close_port (PORT port);
-void send (PORT dest_port, void* data);
-void message (PORT dest_port, void* data);
+BOOL send (PORT dest_port, void* data);
+BOOL send_buf (PORT dest_port, void* data, int len);
+BOOL message (PORT dest_port, void* data);
+BOOL message_buf (PORT dest_port, void* data, int len);
 void* receive (PROCESS* sender);
+void* receive_buf (PROCESS* sender, int* len);
+void* receive_port (PORT port, PROCESS* sender);
+void* receive_select (PORT_SET* set, PROCESS* sender, PORT* from);
+int receive_copy (PROCESS* sender, void* buf, int buf_len);
+void* try_receive (PROCESS* sender);
+void* receive_timeout (PROCESS* sender, int ticks);
 void reply (PROCESS sender);
 void init_ipc();
 
 
 /*=====>>> intr.c <<<=======================================================*/
 
+/*
+ * With SMP, a critical section also holds the kernel lock, which
+ * keeps the other CPUs out of the kernel.
+ */
 #define DISABLE_INTR(save)	asm ("pushfl");                   \
                                 asm ("popl %0" : "=r" (save) : ); \
-				asm ("cli");
+				asm ("cli");                      \
+				lock_kernel();
 
-#define ENABLE_INTR(save) 	asm ("pushl %0" : : "m" (save)); \
+#define ENABLE_INTR(save) 	unlock_kernel();                  \
+				asm ("pushl %0" : : "m" (save)); \
 				asm ("popfl");
 
 
@@ -223,32 +392,83 @@ typedef struct
     unsigned short offset_16_31;
 } IDT;
 
+typedef struct
+{
+    unsigned short limit_0_15;
+    unsigned short base_0_15;
+    unsigned char  base_16_23;
+    unsigned char  access;
+    unsigned char  limit_16_19_flags;
+    unsigned char  base_24_31;
+} GDT;
+
 #define CODE_SELECTOR 0x8
 #define DATA_SELECTOR 0x10
 #define MAX_INTERRUPTS 256
 #define IDT_ENTRY_SIZE 8
 
 
+/* vectors of the 16 lines of the two 8259A PICs */
+#define IRQ_BASE    0x60
+#define NUM_IRQS    16
+#define IRQ_CASCADE (IRQ_BASE + 2)
+#define RTC_IRQ     0x68
+#define IDE_IRQ     0x6E
+#define IDE2_IRQ    0x6F
+
+typedef void (*INTR_HANDLER) (int intr_no);
+
 extern BOOL interrupts_initialized;
+extern unsigned spurious_irqs;
+extern INTR_HANDLER intr_handler[];
+extern PROCESS interrupt_table[];
+extern unsigned int _TOS_time;
 
 unsigned int get_TOS_time();
+extern IDT idt[];
+
+void load_idt (IDT* base);
 void init_idt_entry (int intr_no, void (*isr) (void));
+void init_gdt_entry (GDT *table, int selector, unsigned base, unsigned limit,
+                     unsigned char access, unsigned char flags);
+BOOL wake_intr_process (int intr_no);
+void register_interrupt_handler (int intr_no, INTR_HANDLER handler);
 void wait_for_interrupt (int intr_no);
+void release_interrupts (PROCESS proc);
 void init_interrupts ();
 
 
 /*=====>>> timer.c <<<===================================================*/
 
 #define TIMER_IRQ   0x60
+#define TIMER_HZ    1000
 
 extern PORT timer_port;
 
 typedef struct _Timer_Message 
 {
-    int num_of_ticks;
+    int num_of_ticks;		/* for send() */
+    unsigned int until;		/* for send_buf(): absolute tick */
 } Timer_Message;
 
+typedef struct _Timer *TIMER;
+
 void sleep(int ticks);
+void sleep_until(unsigned int tick);
+TIMER periodic_timer(int period);
+int wait_periodic(TIMER t);
+void cancel_periodic(TIMER t);
+void release_timers(PROCESS proc);
+extern BOOL tickless_idle;
+extern unsigned timer_hz;
+
+TIMER add_timeout(PROCESS proc, int ticks);
+void cancel_timeout(TIMER t);
+void enter_tickless_idle();
+void leave_tickless_idle();
+void init_pit(unsigned hz);
+int ms_to_ticks(int ms);
+unsigned get_time_us();
 void init_timer();
 
 
@@ -278,9 +498,70 @@ typedef struct _COM_Message
     int   len_input_buffer;
 } COM_Message;
 
+void write_com2 (const void* buf, int len);
 void init_com();
 
 
+/*=====>>> trace.c <<<===================================================*/
+
+#define TRACE_DISPATCH  1       /* arg: process that gets the CPU */
+#define TRACE_INTR      2       /* arg: interrupt number */
+#define TRACE_SEND      3       /* arg: port, data: length */
+#define TRACE_MESSAGE   4       /* arg: port, data: length */
+#define TRACE_RECEIVE   5       /* arg: sender, data: port */
+#define TRACE_REPLY     6       /* arg: process replied to */
+#define TRACE_TIMER     7       /* arg: owner of the timer, data: type */
+
+typedef struct _TRACE_RECORD
+{
+    unsigned long long tsc;
+    unsigned char  event;
+    unsigned char  proc;        /* running process */
+    unsigned short arg;
+    unsigned       data;
+} TRACE_RECORD;
+
+extern TRACE_RECORD trace_buffer[];
+extern volatile unsigned trace_next;
+extern BOOL trace_enabled;
+
+/* Costs a compare while tracing is off */
+#define TRACE(event, arg, data) \
+    do { if (trace_enabled) trace_record(event, arg, data); } while (0)
+
+unsigned long long read_tsc();
+void trace_record(int event, int arg, unsigned data);
+void trace_start();
+void trace_stop();
+int trace_dump();
+
+
+/*=====>>> klog.c <<<====================================================*/
+
+#define KLOG_LINES      64      /* must be a power of 2 */
+#define KLOG_LINE_SIZE  160     /* longer kprintf() output is cut off */
+
+typedef struct _KLOG_LINE
+{
+    volatile unsigned seq;      /* number of the line + 1, 0 while written */
+    char text[KLOG_LINE_SIZE];
+} KLOG_LINE;
+
+extern KLOG_LINE klog_ring[];
+extern volatile unsigned klog_next;
+extern unsigned klog_drained;
+extern unsigned klog_lost;
+extern BOOL klog_drain;
+extern BOOL klog_com2;
+
+void klog_write(const char *text);
+BOOL klog_read(unsigned i, char *buf);
+BOOL klog_job(void* data);
+void klog_flush();
+int klog_print(WINDOW* wnd);
+void init_klog();
+
+
 /*=====>>> keyb.c <<<====================================================*/
 
 #define TOS_UP    17
@@ -373,9 +654,74 @@ void init_graphics();
 int start_graphic_vga();
 int start_text_mode();
 
+/*=====>>> smp.c <<<=====================================================*/
+
+/*
+ * Compile with -DSMP (see MakeVars) to run processes on all CPUs.
+ */
+#define MAX_CPUS		8
+
+/* STARTUP IPI vector: the APs start at 0300:0000 */
+#define AP_TRAMPOLINE_BASE	0x3000
+
+/* IPI that makes a CPU call the dispatcher */
+#define IPI_RESCHED_INTR	0x50
+
+typedef struct _CPU {
+    PROCESS   current;           /* Process running on this CPU */
+    int       id;                /* Index in cpus[] */
+    unsigned  apic_id;           /* ID of its local APIC, for IPIs */
+    PROCESS   idle;              /* Runs when nothing is ready, NULL on
+                                    the BSP, which has the null process */
+    BOOL      online;
+} CPU;
+
+extern CPU cpus[];
+extern int smp_cpus;
+extern BOOL smp_enabled;
+
+void switch_done();
+
+#ifdef SMP
+#ifdef STACK_GUARD_PAGES
+#error "the local APIC is not mapped with STACK_GUARD_PAGES"
+#endif
+
+/*
+ * The %gs of every CPU selects a segment based at its entry of cpus[]
+ * (see smp.c). The number of the CPU and its process are therefore a
+ * single load, which a move of the caller to another CPU cannot split.
+ */
+#define CPU_CURRENT_OFFSET	0	/* of current in CPU */
+#define CPU_ID_OFFSET		4	/* of id in CPU */
+
+#define cpu_id()		({ int _id;                            \
+				   asm volatile ("movl %%gs:%c1, %0"    \
+						 : "=r" (_id)           \
+						 : "i" (CPU_ID_OFFSET)); \
+				   _id; })
+#define current_proc()		({ PROCESS _proc;                      \
+				   asm volatile ("movl %%gs:%c1, %0"    \
+						 : "=r" (_proc)         \
+						 : "i" (CPU_CURRENT_OFFSET)); \
+				   _proc; })
+
+void init_cpu_segments();
+void lock_kernel();
+void unlock_kernel();
+void switch_cpu(PROCESS from, PROCESS to);
+void smp_tick();
+void smp_kick_idle();
+void init_smp();
+#else
+#define cpu_id()		0
+#define lock_kernel()
+#define unlock_kernel()
+#endif
+
 /*=====>>> tos_logo.c <<<================================================*/
 
-#define LOGO_ANIMATION_SLIDE_TIME 15
+#define LOGO_ANIMATION_SLIDE_TIME 824	/* ms, 15 ticks at 18.2 Hz */
 
 void tos_splash_screen(int time);
 
@@ -58,6 +58,7 @@ void test_dispatcher_4();
 void test_dispatcher_5();
 void test_dispatcher_6();
 void test_dispatcher_7();
+void test_dispatcher_8();
 
 void test_ipc_1();
 void test_ipc_2();
@@ -65,13 +66,30 @@ void test_ipc_3();
 void test_ipc_4();
 void test_ipc_5();
 void test_ipc_6();
+void test_ipc_7();
+void test_ipc_8();
+void test_ipc_9();
+void test_ipc_10();
 
 void test_isr_1();
 void test_isr_2();
 void test_isr_3();
+void test_isr_4();
 
 void test_timer_1();
+void test_timer_2();
+void test_timer_3();
+void test_timer_4();
+void test_timer_5();
+void test_dispatcher_9();
 void test_com_1();
+void test_trace_1();
+void test_null_1();
+void test_kill_1();
 void test_fork_1();
+void test_fork_2();
+void test_window_5();
+void test_window_6();
+void test_klog_1();
 
 #endif
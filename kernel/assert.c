@@ -7,9 +7,11 @@ static WINDOW error_window = {0, 24, 80, 1, 0, 0, ' '};
 int failed_assertion(const char* ex, const char* file, int line)
 {
     asm ("cli");
+    klog_flush();
     clear_window(&error_window);
     wprintf(&error_window, "Failed assertion '%s' at line %d of %s",
 	    ex, line, file);
+    flush_console();
     while (1) ;
     return 0;
 }
@@ -18,8 +20,10 @@ int failed_assertion(const char* ex, const char* file, int line)
 void panic_mode(const char* msg, const char* file, int line)
 {
     asm ("cli");
+    klog_flush();
     clear_window(&error_window);
     wprintf(&error_window, "PANIC: '%s' at line %d of %s",
 	    msg, line, file);
+    flush_console();
     while (1) ;
 }
@@ -52,7 +52,7 @@ void com_process (PROCESS self, PARAM param)
     PROCESS user_proc;
     PROCESS reader_proc;
     PORT com_reader_port = create_new_port(active_proc);
-    com_reader_port = create_process(com_reader_process, 7, (LONG)com_reader_port, "COM reader");
+    com_reader_port = create_process_stack(com_reader_process, 7, (LONG)com_reader_port, "COM reader", SMALL_STACK_SIZE);
     
     while (1) { 
         
@@ -112,6 +112,51 @@ void init_uart()
 //  inportb (COM1_PORT); 
 // }
 
+/*
+ * COM2 is only used for bulk output such as trace dumps. It runs at
+ * 115200 baud, 8N1, without interrupts.
+ */
+void init_com2_uart()
+{
+    /* LineControl disabled to set baud rate */
+    outportb (COM2_PORT + 3, 0x80);
+    /* divisor 1: 115200 baud */
+    outportb (COM2_PORT + 0, 0x01);
+    outportb (COM2_PORT + 1, 0x00);
+    /* 8 Bits, No Parity, 1 stop bit */
+    outportb (COM2_PORT + 3, 0x03);
+    /* no interrupts */
+    outportb (COM2_PORT + 1, 0);
+    /* enable and clear the FIFOs */
+    outportb (COM2_PORT + 2, 0xc7);
+    /* Modem control: DTR, RTS */
+    outportb (COM2_PORT + 4, 0x03);
+}
+
+BOOL com2_initialized = FALSE;
+
+/*
+ * write_com2
+ *----------------------------------------------------------------------------
+ * Writes len bytes to COM2, polling the UART.
+ */
+void write_com2 (const void *buf, int len)
+{
+    const unsigned char *p = buf;
+
+    if (!com2_initialized) {
+        init_com2_uart();
+        com2_initialized = TRUE;
+    }
+
+    while (len-- > 0)
+    {
+        // wait till UART ready to receive next byte
+        while (!(inportb(COM2_PORT + 5) & (1 << 5)));
+        outportb(COM2_PORT, *p++);
+    }
+}
+
 void init_com ()
 {
     init_uart();
@@ -4,7 +4,9 @@
 #include "disptable.c"
 
 
+#ifndef SMP
 PROCESS active_proc;
+#endif
 
 
 /*
@@ -12,6 +14,85 @@ PROCESS active_proc;
  */
 PCB *ready_queue [MAX_READY_QUEUES];
 
+/*
+ * Bit n is set iff ready_queue[n] is not empty.
+ */
+unsigned ready_mask;
+
+
+
+/*
+ * Adds the ticks since proc->stats_since to the state being counted
+ * and starts counting state.
+ */
+void charge_state(PROCESS proc, int state)
+{
+	proc->stats.state_ticks[proc->stats_state] += _TOS_time - proc->stats_since;
+	proc->stats_state = state;
+	proc->stats_since = _TOS_time;
+}
+
+
+/*
+ * init_proc_stats
+ *----------------------------------------------------------------------------
+ * Clears the counters of a new process.
+ */
+
+void init_proc_stats (PROCESS proc)
+{
+	k_memset(&proc->stats, 0, sizeof(PROC_STATS));
+	proc->stats_state = STATE_READY;
+	proc->stats_since = _TOS_time;
+}
+
+
+/*
+ * account_switch
+ *----------------------------------------------------------------------------
+ * Called with interrupts disabled when the CPU is taken from process
+ * from and given to process to. The switch is voluntary if from
+ * blocked or resigned.
+ */
+
+void account_switch (PROCESS from, PROCESS to, BOOL voluntary)
+{
+	if (voluntary || from->state != STATE_READY)
+	{
+		from->stats.voluntary++;
+	}
+	else
+	{
+		from->stats.preempted++;
+	}
+	from->stats_state = from->state;
+	from->stats_since = _TOS_time;
+
+	to->stats.dispatches++;
+	charge_state(to, STATE_READY);
+}
+
+
+/*
+ * get_proc_stats
+ *----------------------------------------------------------------------------
+ * Copies the counters of proc to *stats, including the ticks of the
+ * state it is in right now.
+ */
+
+void get_proc_stats (PROCESS proc, PROC_STATS* stats)
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	k_memcpy(stats, &proc->stats, sizeof(PROC_STATS));
+	if (proc != active_proc)
+	{
+		stats->state_ticks[proc->stats_state] += _TOS_time - proc->stats_since;
+	}
+
+	ENABLE_INTR(saved_if);
+}
 
 
 /*
@@ -40,6 +121,14 @@ void add_ready_queue (PROCESS proc)
 
 	// clear_window(kernel_window);
 
+	if (proc->on_ready_queue)
+	{
+		/* already queued, don't link it twice */
+		proc->state = STATE_READY;
+		ENABLE_INTR(saved_if);
+		return;
+	}
+
 	head = ready_queue[proc->priority];
 	if(head != NULL)
 	{
@@ -53,30 +142,30 @@ void add_ready_queue (PROCESS proc)
 		ready_queue[proc->priority] = proc;
 		proc->next = proc;
 		proc->prev = proc;
+		ready_mask |= 1 << proc->priority;
+	}
+	proc->on_ready_queue = TRUE;
+	if (proc->state != STATE_READY && proc != active_proc)
+	{
+		/* the blocked time ends, the time waiting for the CPU starts */
+		charge_state(proc, STATE_READY);
 	}
 	proc->state = STATE_READY;
 
+#ifdef SMP
+	if (proc->cpu < 0)
+	{
+		smp_kick_idle();
+	}
+#endif
+
 	ENABLE_INTR(saved_if); 
 }
 
 
 BOOL in_ready_queue(PROCESS proc)
 {
-	PROCESS rq_proc = ready_queue[proc->priority];
-	if (rq_proc != NULL)
-	{
-		// priority level has items
-		do
-		{
-		 	if (rq_proc == proc)
-		 	{
-		 		return TRUE;
-		 	}
-		 	rq_proc = rq_proc->next;
-		} 
-		while (rq_proc != ready_queue[proc->priority]);
-	}
-	return FALSE;
+	return proc->on_ready_queue;
 }
 
 /*
@@ -101,12 +190,15 @@ void remove_ready_queue (PROCESS proc)
 	else if(proc->next == proc) /* proc only process in queue */
 	{
 		ready_queue[proc->priority] = NULL;
+		ready_mask &= ~(1 << proc->priority);
+		proc->on_ready_queue = FALSE;
 	}
 	else /* multiple processes in queue */
 	{
 		ready_queue[proc->priority] = proc->next;
 		proc->next->prev = proc->prev;
 		proc->prev->next = proc->next;
+		proc->on_ready_queue = FALSE;
 	}
 	// proc->next = NULL;
 	// proc->prev = NULL;
@@ -119,88 +211,123 @@ void remove_ready_queue (PROCESS proc)
 
 
 
+/*
+ * set_priority
+ *----------------------------------------------------------------------------
+ * Changes the priority of proc. A process on the ready queues is moved
+ * to the queue of its new priority.
+ */
+
+void set_priority (PROCESS proc, int prio)
+{
+	unsigned short state;
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	assert(prio < MAX_READY_QUEUES && prio >= 0);
+
+	if (proc->priority != prio)
+	{
+		if (in_ready_queue(proc))
+		{
+			state = proc->state;
+			remove_ready_queue(proc);
+			proc->priority = prio;
+			add_ready_queue(proc);
+			proc->state = state;
+		}
+		else
+		{
+			proc->priority = prio;
+		}
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+
 /*
  * dispatcher
  *----------------------------------------------------------------------------
  * Determines a new process to be dispatched. The process
  * with the highest priority is taken. Within one priority
- * level round robin is used.
+ * level round robin is used. The highest non-empty queue is
+ * found with a single bit scan of ready_mask.
  */
 
+#ifdef SMP
+
+/*
+ * With SMP the dispatcher skips the ready processes that run on other
+ * CPUs. The null process only runs on the BSP; an AP with nothing to
+ * do runs its idle process.
+ */
 PROCESS dispatcher()
 {
 	int prio;
-	PROCESS proc = NULL;
+	unsigned mask;
+	PROCESS proc, first;
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	for(prio = MAX_READY_QUEUES - 1; prio >= 0; prio--)
+	mask = ready_mask;
+	if (cpu_id() != 0)
+	{
+		mask &= ~1;
+	}
+	while (mask != 0)
 	{
-		if(ready_queue[prio] == NULL)
+		HIGHEST_BIT(mask, prio);
+		if(prio == active_proc->priority && active_proc->on_ready_queue)
 		{
-			continue;
+			first = active_proc->next;
 		}
-		else if(prio == active_proc->priority)
-		{
-			proc = active_proc->next;
-			break;
-		} 
 		else
 		{
-			proc = ready_queue[prio];
-			break;
+			first = ready_queue[prio];
 		}
+		proc = first;
+		do
+		{
+			if (proc->cpu < 0 || proc == active_proc)
+			{
+				ENABLE_INTR(saved_if);
+				return proc;
+			}
+			proc = proc->next;
+		} while (proc != first);
+		mask &= ~(1 << prio);
 	}
-	ENABLE_INTR(saved_if); 
+	proc = cpus[cpu_id()].idle;
+	ENABLE_INTR(saved_if);
 	return proc;
 }
 
+#else
 
-/*
- * resign
- *----------------------------------------------------------------------------
- * The current process gives up the CPU voluntarily. The
- * next running process is determined via dispatcher().
- * The stack of the calling process is setup such that it
- * looks like an interrupt.
- */
-void resign()
+PROCESS dispatcher()
 {
-	asm volatile ("pushfl;"
-		"cli;"
-		"popl %%eax;"
-		"xchg (%%esp), %%eax;"
-		"push %%cs;"
-		"pushl %%eax;"
-		"pushl %%eax;"
-		"pushl %%ecx;"
-		"pushl %%edx;"
-		"pushl %%ebx;"
-		"pushl %%ebp;"
-		"pushl %%esi;"
-		"pushl %%edi;"
-		"movl %%esp, %0"
-		: "=r" (active_proc->esp)
-		:
-		);
-
-	active_proc = dispatcher();
-	
-	asm volatile ("movl %0, %%esp;"
-		"popl %%edi;"
-		"popl %%esi;"
-		"popl %%ebp;"
-		"popl %%ebx;"
-		"popl %%edx;"
-		"popl %%ecx;"
-		"popl %%eax;"
-		"iret"
-		: 
-		: "r" (active_proc->esp)
-		);
-	/* implicit ret */
-}
+	int prio;
+	PROCESS proc = NULL;
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
+	if (ready_mask != 0)
+	{
+		HIGHEST_BIT(ready_mask, prio);
+		if(prio == active_proc->priority && active_proc->on_ready_queue)
+		{
+			proc = active_proc->next;
+		}
+		else
+		{
+			proc = ready_queue[prio];
+		}
+	}
+	ENABLE_INTR(saved_if); 
+	return proc;
+}
+#endif
 
 
 /*
@@ -212,6 +339,7 @@ void resign()
 void init_dispatcher()
 {
 	PROCESS *rq, *end;
+	PROCESS proc, pcb_end;
 
 	/* initialize all slots in ready queue to NULL */
 	end = ready_queue + MAX_READY_QUEUES;
@@ -220,6 +348,14 @@ void init_dispatcher()
 	{
 		*rq = (PROCESS)NULL;
 	}
+	ready_mask = 0;
+
+	/* no process is linked into the now empty queues */
+	pcb_end = pcb + MAX_PROCS;
+	for (proc = pcb; proc < pcb_end; proc++)
+	{
+		proc->on_ready_queue = FALSE;
+	}
 
 	/* add initial/null process to ready queue */
 
@@ -5,7 +5,6 @@ BOOL interrupts_initialized = FALSE;
 
 IDT idt [MAX_INTERRUPTS];
 PROCESS interrupt_table [MAX_INTERRUPTS];
-PROCESS p;
 // shouldn't overflow for about a month if 1000 timer interupts per second
 unsigned int _TOS_time = 0;
 
@@ -41,369 +40,380 @@ void init_idt_entry (int intr_no, void (*isr) (void))
     i->offset_16_31 = ((unsigned int)isr >> 16) & 0xffff;
 }
 
-void add_ready_queue_p()
+
+void init_gdt_entry (GDT *table, int selector, unsigned base, unsigned limit,
+                     unsigned char access, unsigned char flags)
 {
-    add_ready_queue(p);
+    GDT *g = table + selector / 8;
+
+    g->limit_0_15        = limit & 0xffff;
+    g->base_0_15         = base & 0xffff;
+    g->base_16_23        = (base >> 16) & 0xff;
+    g->access            = access;
+    g->limit_16_19_flags = ((limit >> 16) & 0x0f) | (flags << 4);
+    g->base_24_31        = (base >> 24) & 0xff;
 }
 
+#ifdef STACK_GUARD_PAGES
+
 /*
- * Timer ISR
+ * With guard pages a stack overflow raises a page fault, and pushing
+ * the exception frame onto the same exhausted stack then raises a
+ * double fault. The double fault is therefore routed through a task
+ * gate, which switches to a TSS that has a stack of its own. This
+ * needs a GDT with TSS descriptors, so the kernel installs its own
+ * copy of the boot loader's GDT.
  */
-void isr_timer ();
-void dummy_isr_timer ()
+
+typedef struct
 {
-    /*
-     *  PUSHL   %EAX        ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     * Save the context pointer ESP to the PCB
-     */
-     asm volatile (
-        "isr_timer:;"
-        "pushl %%eax;"
-        "pushl %%ecx;"
-        "pushl %%edx;"
-        "pushl %%ebx;"
-        "pushl %%ebp;"
-        "pushl %%esi;"
-        "pushl %%edi;"
-        "movl %%esp, %0"
-        : "=r" (active_proc->esp)
-        :
-        );
-
-    p = interrupt_table[TIMER_IRQ];
-
-    if (p != NULL && p->state == STATE_INTR_BLOCKED)
-    {        
-        /* Add event handler to ready queue */
-        add_ready_queue_p();
-    }
+    unsigned       link;
+    unsigned       esp0, ss0, esp1, ss1, esp2, ss2;
+    unsigned       cr3, eip, eflags;
+    unsigned       eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned       es, cs, ss, ds, fs, gs;
+    unsigned       ldt;
+    unsigned short trap;
+    unsigned short iomap_base;
+} TSS;
+
+#define KERNEL_TSS_SELECTOR       0x20
+#define DOUBLE_FAULT_TSS_SELECTOR 0x28
+#define DOUBLE_FAULT_INTR         8
+#define DOUBLE_FAULT_STACK_SIZE   4096
+#define MAX_GDT_ENTRIES           6
+
+GDT gdt [MAX_GDT_ENTRIES];
+TSS kernel_tss;
+TSS double_fault_tss;
+unsigned char double_fault_stack [DOUBLE_FAULT_STACK_SIZE];
+
+
+void double_fault_task ()
+{
+    static char msg [80];
+
+    /* kernel_tss holds the state of the faulting process */
+    if (kernel_tss.esp < active_proc->stack_base + 64)
+        k_sprintf (msg, "Stack overflow in %s", active_proc->name);
+    else
+        k_sprintf (msg, "Double fault in %s", active_proc->name);
+    panic (msg);
+}
 
-    _TOS_time++;
 
-    active_proc = dispatcher();
-
-    /*
-     *  Restore context pointer ESP
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET        ; Return to new process
-     */
-    asm volatile (
-        "movl %0, %%esp;"
-        "movb $0x20,%%al;"
-        "outb %%al,$0x20;"
-        "popl %%edi;"
-        "popl %%esi;"
-        "popl %%ebp;"
-        "popl %%ebx;"
-        "popl %%edx;"
-        "popl %%ecx;"
-        "popl %%eax;"
-        "iret"
-        : 
-        : "r" (active_proc->esp)
-        );
+void init_double_fault_task ()
+{
+    volatile unsigned char mem48 [6];
+    IDT *i = idt + DOUBLE_FAULT_INTR;
+    unsigned cr3;
+
+    /* same flat segments as the boot loader, plus two TSS */
+    k_memset (gdt, 0, sizeof (gdt));
+    init_gdt_entry (gdt, CODE_SELECTOR, 0, 0xfffff, 0x9a, 0xc);
+    init_gdt_entry (gdt, DATA_SELECTOR, 0, 0xfffff, 0x92, 0xc);
+    init_gdt_entry (gdt, 0x18, 0, 0xfffff, 0x92, 0xc);
+    init_gdt_entry (gdt, KERNEL_TSS_SELECTOR, (unsigned) &kernel_tss,
+                    sizeof (TSS) - 1, 0x89, 0);
+    init_gdt_entry (gdt, DOUBLE_FAULT_TSS_SELECTOR, (unsigned) &double_fault_tss,
+                    sizeof (TSS) - 1, 0x89, 0);
+
+    *((unsigned short *) &mem48[0]) = sizeof (gdt) - 1;
+    *((unsigned *) &mem48[2])       = (unsigned) gdt;
+    asm ("lgdt %0" : "=m" (mem48));
+    asm ("ltr %w0" : : "r" (KERNEL_TSS_SELECTOR));
+
+    asm ("movl %%cr3, %0" : "=r" (cr3));
+    k_memset (&double_fault_tss, 0, sizeof (TSS));
+    double_fault_tss.cr3    = cr3;
+    double_fault_tss.eip    = (unsigned) double_fault_task;
+    double_fault_tss.eflags = 0x2;
+    double_fault_tss.esp    = (unsigned) (double_fault_stack + DOUBLE_FAULT_STACK_SIZE);
+    double_fault_tss.cs     = CODE_SELECTOR;
+    double_fault_tss.ss     = DATA_SELECTOR;
+    double_fault_tss.ds     = DATA_SELECTOR;
+    double_fault_tss.es     = DATA_SELECTOR;
+    double_fault_tss.fs     = DATA_SELECTOR;
+    double_fault_tss.gs     = DATA_SELECTOR;
+    double_fault_tss.iomap_base = sizeof (TSS);
+
+    /* task gate */
+    i->offset_0_15  = 0;
+    i->selector     = DOUBLE_FAULT_TSS_SELECTOR;
+    i->dword_count  = 0;
+    i->unused       = 0;
+    i->type         = 0x5;
+    i->dt           = 0;
+    i->dpl          = 0;
+    i->p            = 1;
+    i->offset_16_31 = 0;
 }
 
+#endif
 
+/*
+ * The assembly stubs in isr.s save the context of the interrupted
+ * process and call service_intr(), which in turn calls the C handler
+ * registered for the vector in intr_handler[]. A NULL handler means
+ * the interrupt is ignored.
+ */
+
+#define ISR_STUB_SIZE 16
+
+#define PIC_MASTER    0x20
+#define PIC_SLAVE     0xA0
+#define PIC_EOI       0x20
+#define PIC_READ_ISR  0x0B
+
+#define IS_IRQ(intr_no)  ((intr_no) >= IRQ_BASE && (intr_no) < IRQ_BASE + NUM_IRQS)
+#define IRQ_BIT(intr_no) (1 << ((intr_no) - IRQ_BASE))
+
+extern char isr_stubs [];
+
+INTR_HANDLER intr_handler [MAX_INTERRUPTS];
 
 /*
- * COM1 ISR
+ * One bit per IRQ line. A set bit in irq_mask means the line is masked
+ * in the PIC. A set bit in irq_pending means the interrupt occurred
+ * while no process was waiting for it.
  */
-void isr_com1 ();
-void dummy_isr_com1 ()
+unsigned short irq_mask;
+unsigned short irq_pending;
+
+unsigned spurious_irqs;
+
+
+void write_irq_mask ()
 {
-    /*
-     *  PUSHL   %EAX        ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     * Save the context pointer ESP to the PCB
-     */
-     asm volatile (
-        "isr_com1:;"
-        "pushl %%eax;"
-        "pushl %%ecx;"
-        "pushl %%edx;"
-        "pushl %%ebx;"
-        "pushl %%ebp;"
-        "pushl %%esi;"
-        "pushl %%edi;"
-        "movl %%esp, %0"
-        : "=r" (active_proc->esp)
-        :
-        );
-
-    p = interrupt_table[COM1_IRQ];
-
-    if (p == NULL) {
-        panic ("service_intr_0x64: Spurious interrupt");
-    }
+    outportb (PIC_MASTER + 1, irq_mask & 0xff);
+    outportb (PIC_SLAVE + 1, irq_mask >> 8);
+}
 
-    if (p->state != STATE_INTR_BLOCKED) {
-        panic ("service_intr_0x64: No process waiting");
-    }
 
-    /* Add event handler to ready queue */
-    add_ready_queue_p();
-
-    active_proc = dispatcher();
-
-    /*
-     *  Restore context pointer ESP
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET        ; Return to new process
-     */
-    asm volatile (
-        "movl %0, %%esp;"
-        "movb $0x20,%%al;"
-        "outb %%al,$0x20;"
-        "popl %%edi;"
-        "popl %%esi;"
-        "popl %%ebp;"
-        "popl %%ebx;"
-        "popl %%edx;"
-        "popl %%ecx;"
-        "popl %%eax;"
-        "iret"
-        : 
-        : "r" (active_proc->esp)
-        );
+void mask_irq (int intr_no)
+{
+    irq_mask |= IRQ_BIT (intr_no);
+    write_irq_mask ();
+}
+
+
+void unmask_irq (int intr_no)
+{
+    irq_mask &= ~IRQ_BIT (intr_no);
+    write_irq_mask ();
 }
 
 
 /*
- * Keyboard ISR
+ * IRQ 7 and IRQ 15 are raised by the PIC itself when a request goes
+ * away before it is acknowledged. Such an interrupt is not marked as
+ * in service and must not be acknowledged, except that a spurious
+ * IRQ 15 still needs an EOI for the cascade line on the master.
  */
-void isr_keyb();
-void dummy_isr_keyb()
+BOOL is_spurious_irq (int intr_no)
 {
-    /*
-     *  PUSHL   %EAX        ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     * Save the context pointer ESP to the PCB
-     */
-     asm volatile (
-        "isr_keyb:;"
-        "pushl %%eax;"
-        "pushl %%ecx;"
-        "pushl %%edx;"
-        "pushl %%ebx;"
-        "pushl %%ebp;"
-        "pushl %%esi;"
-        "pushl %%edi;"
-        "movl %%esp, %0"
-        : "=r" (active_proc->esp)
-        :
-        );
-
-    p = interrupt_table[KEYB_IRQ];
-
-    if (p == NULL) {
-	panic ("service_intr_0x61: Spurious interrupt");
-    }
+    unsigned short pic;
+
+    if (intr_no == IRQ_BASE + 7)
+        pic = PIC_MASTER;
+    else if (intr_no == IRQ_BASE + 15)
+        pic = PIC_SLAVE;
+    else
+        return FALSE;
+
+    outportb (pic, PIC_READ_ISR);
+    if (inportb (pic) & 0x80)
+        return FALSE;
+
+    if (pic == PIC_SLAVE)
+        outportb (PIC_MASTER, PIC_EOI);
+    spurious_irqs++;
+    return TRUE;
+}
 
-    if (p->state != STATE_INTR_BLOCKED) {
-	panic ("service_intr_0x61: No process waiting");
-    }
+
+void send_eoi (int intr_no)
+{
+    if (intr_no >= IRQ_BASE + 8)
+        outportb (PIC_SLAVE, PIC_EOI);
+    outportb (PIC_MASTER, PIC_EOI);
+}
+
+
+/*
+ * Makes the process waiting for intr_no ready. Returns FALSE if no
+ * process is waiting for it.
+ */
+BOOL wake_intr_process (int intr_no)
+{
+    PROCESS p = interrupt_table[intr_no];
+
+    if (p == NULL || p->state != STATE_INTR_BLOCKED)
+        return FALSE;
 
     /* Add event handler to ready queue */
-    add_ready_queue_p();
-
-    active_proc = dispatcher();
-
-    /*
-     *  Restore context pointer ESP
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET        ; Return to new process
-     */
-    asm volatile (
-        "movl %0, %%esp;"
-        "movb $0x20,%%al;"
-        "outb %%al,$0x20;"
-        "popl %%edi;"
-        "popl %%esi;"
-        "popl %%ebp;"
-        "popl %%ebx;"
-        "popl %%edx;"
-        "popl %%ecx;"
-        "popl %%eax;"
-        "iret"
-        : 
-        : "r" (active_proc->esp)
-        );
+    add_ready_queue (p);
+    return TRUE;
+}
+
+
+/*
+ * Timer interrupt: wakes up the process waiting for it, if any.
+ * Replaced by the timer wheel once the timer service runs.
+ */
+void timer_intr_handler (int intr_no)
+{
+    wake_intr_process (intr_no);
+    _TOS_time++;
+    active_proc->stats.cpu_ticks++;
+}
+
+
+/*
+ * Device interrupt: wakes up the process waiting for it. If there is
+ * none, the interrupt is remembered for the next wait_for_interrupt()
+ * and the line is masked until then.
+ */
+void device_intr_handler (int intr_no)
+{
+    if (!wake_intr_process (intr_no)) {
+        irq_pending |= IRQ_BIT (intr_no);
+        mask_irq (intr_no);
+    }
 }
 
+
 /*
- * Panic ISR
+ * CPU exceptions
  */
-void isr_panic();
-void dummy_isr_panic()
+void panic_intr_handler (int intr_no)
 {
-    /*
-     *  PUSHL   %EAX        ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     * Save the context pointer ESP to the PCB
-     */
-     asm volatile (
-        "isr_panic:;"
-        "pushl %%eax;"
-        "pushl %%ecx;"
-        "pushl %%edx;"
-        "pushl %%ebx;"
-        "pushl %%ebp;"
-        "pushl %%esi;"
-        "pushl %%edi;"
-        "movl %%esp, %0"
-        : "=r" (active_proc->esp)
-        :
-        );
-
-    print_all_processes(kernel_window);
+    print_all_processes (kernel_window);
     panic ("service_intr_0x0-0xf: Panic interrupt!");
+}
+
+
+/*
+ * service_intr
+ *----------------------------------------------------------------------------
+ * Called from the assembly stubs with interrupts disabled. intr_no is
+ * -1 when called from resign(). context is the stack pointer of the
+ * saved context of active_proc. Returns the saved stack pointer of the
+ * process to switch to, or 0 if active_proc continues to run.
+ */
+MEM_ADDR service_intr (int intr_no, MEM_ADDR context)
+{
+    PROCESS new_proc;
 
-    /*
-     *  Restore context pointer ESP
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET        ; Return to new process
-     */
-    asm volatile (
-        "movl %0, %%esp;"
-        "movb $0x20,%%al;"
-        "outb %%al,$0x20;"
-        "popl %%edi;"
-        "popl %%esi;"
-        "popl %%ebp;"
-        "popl %%ebx;"
-        "popl %%edx;"
-        "popl %%ecx;"
-        "popl %%eax;"
-        "iret"
-        : 
-        : "r" (active_proc->esp)
-        );
+    lock_kernel ();
+
+    if (intr_no >= 0)
+        TRACE (TRACE_INTR, intr_no, 0);
+
+    if (IS_IRQ (intr_no))
+    {
+        if (is_spurious_irq (intr_no))
+        {
+            unlock_kernel ();
+            return 0;
+        }
+
+        /* the null process may have stopped the periodic tick */
+        if (intr_no != TIMER_IRQ)
+            leave_tickless_idle ();
+
+        if (intr_handler[intr_no] != NULL)
+            intr_handler[intr_no] (intr_no);
+
+        /* Reset interrupt controller */
+        send_eoi (intr_no);
+    }
+    else if (intr_no >= 0 && intr_handler[intr_no] != NULL)
+    {
+        intr_handler[intr_no] (intr_no);
+    }
+
+    if (intr_no == TIMER_IRQ)
+    {
+        console_tick ();
+#ifdef SMP
+        smp_tick ();
+#endif
+    }
+
+    new_proc = dispatcher ();
+    if (new_proc == active_proc)
+    {
+        unlock_kernel ();
+        return 0;
+    }
+
+    account_switch (active_proc, new_proc, intr_no < 0);
+    TRACE (TRACE_DISPATCH, new_proc - pcb, 0);
+    active_proc->esp = context;
+#ifdef SMP
+    /* isr_common releases the kernel lock after the switch */
+    switch_cpu (active_proc, new_proc);
+#else
+    active_proc = new_proc;
+#endif
+    return new_proc->esp;
 }
 
+
 /*
- * Default ISR
+ * register_interrupt_handler
+ *----------------------------------------------------------------------------
+ * Installs a C function that is called with interrupts disabled whenever
+ * interrupt intr_no occurs. For the IRQ vectors the line is unmasked, or
+ * masked if handler is NULL. The handler must not block.
  */
-void isr_default();
-void dummy_isr_default()
+void register_interrupt_handler (int intr_no, INTR_HANDLER handler)
 {
-    /*
-     *  PUSHL   %EAX        ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     * Save the context pointer ESP to the PCB
-     */
-     asm volatile (
-        "isr_default:;"
-        "pushl %%eax;"
-        "pushl %%ecx;"
-        "pushl %%edx;"
-        "pushl %%ebx;"
-        "pushl %%ebp;"
-        "pushl %%esi;"
-        "pushl %%edi;"
-        "movl %%esp, %0"
-        : "=r" (active_proc->esp)
-        :
-        );
-
-    /* do nothing */
-
-    /*
-     *  Restore context pointer ESP
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET        ; Return to new process
-     */
-    asm volatile (
-        "movl %0, %%esp;"
-        "movb $0x20,%%al;"
-        "outb %%al,$0x20;"
-        "popl %%edi;"
-        "popl %%esi;"
-        "popl %%ebp;"
-        "popl %%ebx;"
-        "popl %%edx;"
-        "popl %%ecx;"
-        "popl %%eax;"
-        "iret"
-        : 
-        : "r" (active_proc->esp)
-        );
+    volatile int saved_if;
+    DISABLE_INTR(saved_if);
+
+    intr_handler[intr_no] = handler;
+    if (IS_IRQ (intr_no) && intr_no != IRQ_CASCADE)
+    {
+        if (handler == NULL)
+            mask_irq (intr_no);
+        else
+            unmask_irq (intr_no);
+    }
+
+    ENABLE_INTR(saved_if);
 }
 
+
+/*
+ * wait_for_interrupt
+ *----------------------------------------------------------------------------
+ * Blocks the calling process until interrupt intr_no occurs. Any IRQ
+ * line 0x60-0x6F can be waited for; the line is unmasked while a
+ * process waits for it. Returns immediately if the interrupt occurred
+ * since the last call.
+ */
 void wait_for_interrupt (int intr_no)
 {
     volatile int saved_if;
     DISABLE_INTR(saved_if);
 
-    // assert(intr_no == TIMER_IRQ || intr_no == KEYB_IRQ || intr_no == COM1_IRQ);
     assert(interrupt_table[intr_no] == NULL);
 
+    if (IS_IRQ (intr_no))
+    {
+        if (irq_pending & IRQ_BIT (intr_no))
+        {
+            irq_pending &= ~IRQ_BIT (intr_no);
+            ENABLE_INTR(saved_if);
+            return;
+        }
+        if (intr_handler[intr_no] == NULL)
+            intr_handler[intr_no] = device_intr_handler;
+        unmask_irq (intr_no);
+    }
+
     remove_ready_queue(active_proc);
     active_proc->state = STATE_INTR_BLOCKED;
     interrupt_table[intr_no] = active_proc;
@@ -418,6 +428,27 @@ void wait_for_interrupt (int intr_no)
 }
 
 
+/*
+ * Frees the interrupt that proc, which is being killed, waits for.
+ * An IRQ that occurs afterwards is remembered in irq_pending.
+ */
+void release_interrupts (PROCESS proc)
+{
+    int i;
+
+    volatile int saved_if;
+    DISABLE_INTR(saved_if);
+
+    for (i = 0; i < MAX_INTERRUPTS; i++)
+    {
+        if (interrupt_table[i] == proc)
+            interrupt_table[i] = NULL;
+    }
+
+    ENABLE_INTR(saved_if);
+}
+
+
 void delay ()
 {
     asm ("nop;nop;nop");
@@ -444,10 +475,11 @@ void re_program_interrupt_controller ()
     asm ("movb $0x01,%al;outb %al,$0x21;call delay");
     // 8086 mode for 8259A-2
     asm ("movb $0x01,%al;outb %al,$0xA1;call delay");
-    // Don't mask IRQ for 8259A-1
-    asm ("movb $0x00,%al;outb %al,$0x21;call delay");
-    // Don't mask IRQ for 8259A-2
-    asm ("movb $0x00,%al;outb %al,$0xA1;call delay");
+    // Mask all lines except the cascade from 8259A-2. A line is
+    // unmasked when a handler is registered or a process waits for it
+    irq_mask = 0xffff & ~IRQ_BIT (IRQ_CASCADE);
+    irq_pending = 0;
+    write_irq_mask ();
 }
 
 unsigned int get_TOS_time()
@@ -461,26 +493,26 @@ void init_interrupts()
 
     load_idt(idt);
 
-    for(i = 0; i < 16; i++)
-    {
-        init_idt_entry(i, isr_panic);
-    }
-    for(; i < MAX_INTERRUPTS; i++)
+    for(i = 0; i < MAX_INTERRUPTS; i++)
     {
-        init_idt_entry(i, isr_default);
+        init_idt_entry(i, (void (*) (void)) (isr_stubs + i * ISR_STUB_SIZE));
+        intr_handler[i] = (i < 16) ? panic_intr_handler : NULL;
     }
 
-    init_idt_entry(TIMER_IRQ, isr_timer);
-    init_idt_entry(KEYB_IRQ, isr_keyb);
-    init_idt_entry(COM1_IRQ, isr_com1);
+#ifdef STACK_GUARD_PAGES
+    init_double_fault_task();
+#endif
 
     re_program_interrupt_controller();
+    spurious_irqs = 0;
 
     for(i = 0; i < MAX_INTERRUPTS; i++)
     {
         interrupt_table[i] = NULL;
     }
 
+    register_interrupt_handler(TIMER_IRQ, timer_intr_handler);
+
     interrupts_initialized = TRUE;
 
     asm("sti");
@@ -2,7 +2,54 @@
 #include <kernel.h>
 
 PORT_DEF port[MAX_PORTS];
+MAILBOX mailbox[MAX_MAILBOXES];
+
+/* unused ports, linked through next */
+PORT free_port;
+
+
+/*
+ * Every process keeps a bitmap of its open ports that have messages
+ * waiting (ports_ready), indexed like port[], and a summary word with
+ * one bit for each word of the bitmap that is not 0. Finding the next
+ * message is a matter of finding the highest bit in the summary and
+ * then in that word, however many ports the process owns. Ports are
+ * taken from the free list in the order of port[] after init_ipc(),
+ * so newer ports are usually served first, like the head of the
+ * first_port list.
+ */
+
+// recomputes whether port p has messages and whether its owner can
+// receive them, call after any change to its blocked list, its
+// mailbox or whether it is open
+void update_port_pending (PORT p)
+{
+	PROCESS owner = p->owner;
+	int w = PORT_SET_WORD(p);
+	BOOL pending;
 
+	pending = p->blocked_list_head != NULL
+		|| (p->mailbox != NULL && p->mailbox->depth > 0);
+	if (pending != p->pending)
+	{
+		owner->ports_pending += pending ? 1 : -1;
+		p->pending = pending;
+	}
+
+	if (pending && p->open)
+	{
+		owner->ports_ready.word[w] |= PORT_SET_BIT(p);
+		owner->ports_ready_words |= 1 << w;
+	}
+	else
+	{
+		owner->ports_ready.word[w] &= ~PORT_SET_BIT(p);
+		if (owner->ports_ready.word[w] == 0)
+		{
+			owner->ports_ready_words &= ~(1 << w);
+		}
+	}
+}
 
 
 PORT create_port()
@@ -13,7 +60,7 @@ PORT create_port()
 
 PORT create_new_port (PROCESS owner)
 {
-	PORT p, end;
+	PORT p;
 
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
@@ -21,15 +68,9 @@ PORT create_new_port (PROCESS owner)
 	assert(owner->magic == MAGIC_PCB);
 
 	/* allocate unused port */
-	end = port + MAX_PORTS;
-	for (p = port; p < end; p++)
-	{
-		if (p->used == FALSE)
-		{
-			break;
-		}
-	}
-	assert(p != end);
+	p = free_port;
+	assert(p != NULL);
+	free_port = p->next;
 
 	/* Initialize PORT */
 	p->magic 				= MAGIC_PORT;
@@ -37,7 +78,10 @@ PORT create_new_port (PROCESS owner)
 	p->open 				= TRUE;
 	p->owner 				= owner;
 	p->blocked_list_head 	= NULL;
-    p->blocked_list_tail 	= NULL;
+	p->blocked_list_tail 	= NULL;
+	p->mailbox				= NULL;
+	p->pending				= FALSE;
+	p->inherit_priority		= FALSE;
     // p->next 				= NULL;
 
     /* Add new port to head of owner's port list */
@@ -69,11 +113,23 @@ void remove_ports (PROCESS owner)
 		p->owner 				= NULL;
 		p->blocked_list_head 	= NULL;
 	    p->blocked_list_tail 	= NULL;
+	    if (p->mailbox != NULL)
+	    {
+	    	p->mailbox->used	= FALSE;
+	    	p->mailbox			= NULL;
+	    }
 	    p_tmp = p->next;
-	    p->next 				= NULL;
+	    /* return port to the free list */
+	    p->next 				= free_port;
+	    free_port				= p;
 	    p = p_tmp;
 	}
 
+	owner->first_port		= NULL;
+	PORT_SET_CLEAR(owner->ports_ready);
+	owner->ports_ready_words = 0;
+	owner->ports_pending	= 0;
+
 	ENABLE_INTR(saved_if);
 }
 
@@ -81,52 +137,366 @@ void remove_ports (PROCESS owner)
 // false otherwise, checks closed ports
 BOOL check_messages (PROCESS proc)
 {
-	BOOL found = FALSE;
+	return proc->ports_pending != 0;
+}
+
+
+/*
+ * set_port_inheritance
+ *----------------------------------------------------------------------------
+ * With inheritance on, a process that blocks on a send() or message()
+ * to port lends its priority to the owner of the port until the owner
+ * replies to it (or receives the message). This keeps a high priority
+ * client from waiting for a low priority server that is preempted by
+ * unrelated processes of medium priority.
+ */
+void set_port_inheritance (PORT port, BOOL on)
+{
+	assert(port->magic == MAGIC_PORT);
+	port->inherit_priority = on;
+}
+
+
+/*
+ * A server counts the processes that lend it their priority in
+ * lenders[], by the priority of the lender, so it finds the highest
+ * priority it has to keep without looking at other processes. A
+ * lender whose own priority changes moves to another count.
+ */
+
+// changes the priority of proc, which may be lending it to a server
+void update_priority (PROCESS proc, int prio)
+{
+	if (proc->server != NULL)
+	{
+		proc->server->lenders[proc->priority]--;
+		proc->server->lenders[prio]++;
+	}
+	set_priority(proc, prio);
+}
+
+
+// raises the owner of p, and the servers it waits for in turn,
+// to at least the priority of active_proc, which blocks on p
+void inherit_priority (PORT p)
+{
+	PROCESS proc;
+
+	if (!p->inherit_priority)
+	{
+		return;
+	}
+
+	active_proc->server = p->owner;
+	p->owner->lenders[active_proc->priority]++;
+	for (proc = p->owner; proc != NULL; proc = proc->server)
+	{
+		if (proc->priority >= active_proc->priority)
+		{
+			break;
+		}
+		update_priority(proc, active_proc->priority);
+	}
+}
+
+
+// returns server to the highest priority of its own and of the
+// processes still waiting for it
+void restore_priority (PROCESS server)
+{
+	int prio;
+
+	if (server->priority == server->base_priority)
+	{
+		return;
+	}
+
+	for (prio = MAX_READY_QUEUES - 1; prio > server->base_priority; prio--)
+	{
+		if (server->lenders[prio] != 0)
+		{
+			break;
+		}
+	}
+	update_priority(server, prio);
+}
+
+
+// sender no longer waits for server
+void release_server (PROCESS sender)
+{
+	PROCESS server = sender->server;
+
+	if (server != NULL)
+	{
+		server->lenders[sender->priority]--;
+		sender->server = NULL;
+		restore_priority(server);
+	}
+}
+
+
+/*
+ * create_mailbox
+ *----------------------------------------------------------------------------
+ * Attaches a ring of MAILBOX_SIZE messages to port. message() to this
+ * port then returns without waiting for the receiver as long as the
+ * ring is not full. When it is full the sender blocks as usual, or
+ * the message is dropped if drop_when_full is TRUE. Since the sender
+ * continues, the data it passes must stay valid (or be passed by value
+ * in the pointer itself). send() to the port is not affected.
+ */
+void create_mailbox (PORT port, BOOL drop_when_full)
+{
+	MAILBOX *m, *end;
 
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	/* Find first message waiting */
-	PORT p = proc->first_port;
-	while(p != NULL)
+	assert(port->magic == MAGIC_PORT && port->mailbox == NULL);
+
+	end = mailbox + MAX_MAILBOXES;
+	for (m = mailbox; m < end; m++)
 	{
-		if (p->blocked_list_head != NULL)
+		if (m->used == FALSE)
 		{
-			/* Found message */
-			/* remove that process from blocked list */
-			found = TRUE;
 			break;
 		}
-		p = p->next;
 	}
+	assert(m != end);
+
+	m->used				= TRUE;
+	m->drop_when_full	= drop_when_full;
+	m->head				= 0;
+	m->depth			= 0;
+	m->max_depth		= 0;
+	m->drops			= 0;
+	port->mailbox		= m;
 
 	ENABLE_INTR(saved_if);
+}
+
+
+void put_mailbox (MAILBOX* m, PROCESS sender, void* data, int len)
+{
+	int i = (m->head + m->depth) % MAILBOX_SIZE;
+
+	m->sender[i]	= sender;
+	m->data[i]		= data;
+	m->len[i]		= len;
+	m->depth++;
+	if (m->depth > m->max_depth)
+	{
+		m->max_depth = m->depth;
+	}
+}
+
+
+// adds a message to the mailbox of port p
+void put_port_mailbox (PORT p, PROCESS sender, void* data, int len)
+{
+	put_mailbox(p->mailbox, sender, data, len);
+	update_port_pending(p);
+}
+
+
+/*
+ * Removes the oldest message from the mailbox of p. If that makes room
+ * for a sender that blocked on the full ring, its message is moved into
+ * the ring and the sender continues.
+ */
+PROCESS get_mailbox (PORT p, void** data, int* len)
+{
+	MAILBOX* m = p->mailbox;
+	PROCESS sender, waiting;
+
+	sender	= m->sender[m->head];
+	*data	= m->data[m->head];
+	*len	= m->len[m->head];
+	m->head	= (m->head + 1) % MAILBOX_SIZE;
+	m->depth--;
+
+	waiting = p->blocked_list_head;
+	if (waiting != NULL && waiting->state == STATE_MESSAGE_BLOCKED)
+	{
+		p->blocked_list_head = waiting->next_blocked;
+		waiting->next_blocked = NULL;
+		waiting->blocked_on = NULL;
+		if (p->blocked_list_head == NULL)
+		{
+			p->blocked_list_tail = NULL;
+		}
+		put_mailbox(m, waiting, waiting->param_data, waiting->param_len);
+		add_ready_queue(waiting);
+		release_server(waiting);
+	}
+	update_port_pending(p);
+
+	return sender;
+}
+
+
+// takes proc off the blocked list of p
+void unlink_blocked (PORT p, PROCESS proc)
+{
+	PROCESS q, prev = NULL;
+
+	for (q = p->blocked_list_head; q != NULL && q != proc; q = q->next_blocked)
+	{
+		prev = q;
+	}
+	assert(q == proc);
+
+	if (prev == NULL)
+	{
+		p->blocked_list_head = proc->next_blocked;
+	}
+	else
+	{
+		prev->next_blocked = proc->next_blocked;
+	}
+	if (p->blocked_list_tail == proc)
+	{
+		p->blocked_list_tail = prev;
+	}
+	proc->next_blocked = NULL;
+	proc->blocked_on = NULL;
+	update_port_pending(p);
+}
+
+
+// drops the messages of sender queued in the mailbox of p
+void purge_mailbox (PORT p, PROCESS sender)
+{
+	MAILBOX* m = p->mailbox;
+	PROCESS waiting;
+	int i, from, to, depth;
+
+	depth = m->depth;
+	to = m->head;
+	for (i = 0; i < depth; i++)
+	{
+		from = (m->head + i) % MAILBOX_SIZE;
+		if (m->sender[from] == sender)
+		{
+			m->depth--;
+			continue;
+		}
+		m->sender[to]	= m->sender[from];
+		m->data[to]		= m->data[from];
+		m->len[to]		= m->len[from];
+		to = (to + 1) % MAILBOX_SIZE;
+	}
+
+	/* let in the senders that wait for room */
+	while (m->depth < MAILBOX_SIZE && p->blocked_list_head != NULL
+	       && p->blocked_list_head->state == STATE_MESSAGE_BLOCKED)
+	{
+		waiting = p->blocked_list_head;
+		unlink_blocked(p, waiting);
+		put_mailbox(m, waiting, waiting->param_data, waiting->param_len);
+		add_ready_queue(waiting);
+		release_server(waiting);
+	}
+	update_port_pending(p);
+}
+
+
+// proc's peer died, let it continue with send() or message() failing
+void fail_ipc (PROCESS proc)
+{
+	proc->ipc_failed = TRUE;
+	proc->reply_from = NULL;
+	proc->server = NULL;
+	add_ready_queue(proc);
+}
+
+
+/*
+ * release_ipc
+ *----------------------------------------------------------------------------
+ * Detaches proc, which is being killed, from all other processes: it
+ * leaves the blocked list it is on, the messages it queued are
+ * dropped, and the processes waiting for it to receive or reply
+ * continue with send() or message() returning FALSE. Must be called
+ * before remove_ports(proc).
+ */
+void release_ipc (PROCESS proc)
+{
+	PROCESS p;
+	PORT prt;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	if (proc->blocked_on != NULL)
+	{
+		unlink_blocked(proc->blocked_on, proc);
+	}
+	release_server(proc);
+
+	/* senders waiting for proc to receive */
+	for (prt = proc->first_port; prt != NULL; prt = prt->next)
+	{
+		while ((p = prt->blocked_list_head) != NULL)
+		{
+			prt->blocked_list_head = p->next_blocked;
+			p->next_blocked = NULL;
+			p->blocked_on = NULL;
+			fail_ipc(p);
+		}
+		prt->blocked_list_tail = NULL;
+	}
+
+	/* senders waiting for proc to reply */
+	for (p = pcb; p < pcb + MAX_PROCS; p++)
+	{
+		if (p->used == TRUE && p->reply_from == proc
+			&& p->state == STATE_REPLY_BLOCKED)
+		{
+			fail_ipc(p);
+		}
+		else if (p->server == proc)
+		{
+			p->server = NULL;
+		}
+	}
+
+	for (prt = port; prt < port + MAX_PORTS; prt++)
+	{
+		if (prt->used == TRUE && prt->owner != proc && prt->mailbox != NULL)
+		{
+			purge_mailbox(prt, proc);
+		}
+	}
 
-	return found;
+	ENABLE_INTR(saved_if);
 }
 
 
 void open_port (PORT port)
 {
-	// volatile int saved_if;
-	// DISABLE_INTR(saved_if);
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
 	assert(port->magic == MAGIC_PORT);
 	port->open = TRUE;
+	update_port_pending(port);
 
-	// ENABLE_INTR(saved_if);
+	ENABLE_INTR(saved_if);
 }
 
 
 void close_port (PORT port)
 {
-	// volatile int saved_if;
-	// DISABLE_INTR(saved_if);
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
 	assert(port->magic == MAGIC_PORT);
 	port->open = FALSE;
+	update_port_pending(port);
 
-	// ENABLE_INTR(saved_if);
+	ENABLE_INTR(saved_if);
 }
 
 
@@ -147,25 +517,80 @@ void add_to_blocked_list(PORT dest_port)
 	}
 	dest_port->blocked_list_tail = active_proc;
 	active_proc->next_blocked = NULL;
+	active_proc->blocked_on = dest_port;
+	update_port_pending(dest_port);
 
 	ENABLE_INTR(saved_if);
 }
 
 
-void send (PORT dest_port, void* data)
+// TRUE if p is a port in use, FALSE once its owner was killed
+#define PORT_ALIVE(p)	((p)->magic == MAGIC_PORT && (p)->used == TRUE)
+
+// TRUE if the owner of p is receive blocked on a set including p
+#define WAITS_ON_PORT(p)	((p)->open \
+				 && (p)->owner->state == STATE_RECEIVE_BLOCKED \
+				 && ((p)->owner->ports_receiving == NULL \
+				     || PORT_SET_HAS(*(p)->owner->ports_receiving, p)))
+
+
+/*
+ * deliver_message
+ *----------------------------------------------------------------------------
+ * Hands the message of sender that came in on port p to its owner.
+ * If the owner passed a buffer to receive_copy(), the data is copied
+ * into it while the sender's buffer is known to be valid.
+ */
+void deliver_message (PORT p, PROCESS sender, void* data, int len)
+{
+	PROCESS receiver = p->owner;
+
+	receiver->param_proc = sender;
+	receiver->param_port = p;
+	receiver->param_len = len;
+	if (receiver->recv_buf != NULL)
+	{
+		k_memcpy(receiver->recv_buf, data, min(len, receiver->recv_buf_len));
+		data = receiver->recv_buf;
+	}
+	receiver->param_data = data;
+}
+
+
+BOOL send (PORT dest_port, void* data)
+{
+	return send_buf(dest_port, data, 0);
+}
+
+
+/*
+ * send_buf
+ *----------------------------------------------------------------------------
+ * Like send(), but the receiver also learns the length of the buffer
+ * data points to. Returns FALSE if the port was removed, or if its
+ * owner was killed before it replied.
+ */
+BOOL send_buf (PORT dest_port, void* data, int len)
 {
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	assert(dest_port->magic == MAGIC_PORT);
+	if (!PORT_ALIVE(dest_port))
+	{
+		ENABLE_INTR(saved_if);
+		return FALSE;
+	}
+	TRACE(TRACE_SEND, dest_port - port, len);
 
-	if(dest_port->open && dest_port->owner->state == STATE_RECEIVE_BLOCKED)
+	active_proc->ipc_failed = FALSE;
+	active_proc->reply_from = NULL;
+	if(WAITS_ON_PORT(dest_port))
 	{
 		/* Destination can recieve immediately */
 		/* store data in dest PCB */
-		dest_port->owner->param_proc = active_proc;
-		dest_port->owner->param_data = data;
+		deliver_message(dest_port, active_proc, data, len);
 		active_proc->state = STATE_REPLY_BLOCKED;
+		active_proc->reply_from = dest_port->owner;
 		add_ready_queue(dest_port->owner);
 	}
 	else
@@ -174,81 +599,158 @@ void send (PORT dest_port, void* data)
 		/* Store data to own PCB */
 		active_proc->param_proc = active_proc;
 		active_proc->param_data = data;
+		active_proc->param_len = len;
 
 		add_to_blocked_list(dest_port);
 		
 		active_proc->state = STATE_SEND_BLOCKED;
 	}
 	remove_ready_queue(active_proc);
+	inherit_priority(dest_port);
 
 	ENABLE_INTR(saved_if);
 
 	resign();
+
+	return !active_proc->ipc_failed;
+}
+
+
+BOOL message (PORT dest_port, void* data)
+{
+	return message_buf(dest_port, data, 0);
 }
 
 
-void message (PORT dest_port, void* data)
+/*
+ * message_buf
+ *----------------------------------------------------------------------------
+ * Like message(), but the receiver also learns the length of the
+ * buffer data points to. The sender continues as soon as the message
+ * is received, or queued if the port has a mailbox. The mailbox only
+ * keeps the pointer and receive_copy() copies at receive time, so the
+ * buffer must stay valid until the message is received. Returns
+ * FALSE if the message was dropped, the port was removed, or its
+ * owner was killed while the sender waited.
+ */
+BOOL message_buf (PORT dest_port, void* data, int len)
 {
+	BOOL delivered = TRUE;
+
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	assert(dest_port->magic == MAGIC_PORT);
+	if (!PORT_ALIVE(dest_port))
+	{
+		ENABLE_INTR(saved_if);
+		return FALSE;
+	}
+	TRACE(TRACE_MESSAGE, dest_port - port, len);
+
+	active_proc->ipc_failed = FALSE;
 
-	if(dest_port->open && dest_port->owner->state == STATE_RECEIVE_BLOCKED)
+	if(WAITS_ON_PORT(dest_port))
 	{
 		/* Destination can recieve immediately */
 		/* store data in dest PCB */
-		dest_port->owner->param_proc = active_proc;
-		dest_port->owner->param_data = data;
+		deliver_message(dest_port, active_proc, data, len);
 		add_ready_queue(dest_port->owner);
 	}
+	else if (dest_port->mailbox != NULL
+		 && dest_port->mailbox->depth < MAILBOX_SIZE)
+	{
+		/* Room in the mailbox, no need to wait */
+		put_port_mailbox(dest_port, active_proc, data, len);
+	}
+	else if (dest_port->mailbox != NULL && dest_port->mailbox->drop_when_full)
+	{
+		dest_port->mailbox->drops++;
+		delivered = FALSE;
+	}
 	else
 	{
 		/* Must wait for receive */
 		/* Store data to own PCB */
 		active_proc->param_proc = active_proc;
 		active_proc->param_data = data;
+		active_proc->param_len = len;
 
 		add_to_blocked_list(dest_port);
 
 		remove_ready_queue(active_proc);
 		active_proc->state = STATE_MESSAGE_BLOCKED;
+		inherit_priority(dest_port);
 	}
 
 	ENABLE_INTR(saved_if);
 
 	resign();
+
+	return delivered && !active_proc->ipc_failed;
 }
 
 
-PROCESS pop_message( void )
+/*
+ * pop_message
+ *----------------------------------------------------------------------------
+ * Takes the first message waiting on an open port of active_proc in
+ * set, or on any of its open ports if set is NULL. Queued mailbox
+ * messages come before blocked senders of the same port. *queued
+ * tells whether the message came from a mailbox, in which case the
+ * sender is not blocked on it.
+ */
+PROCESS pop_message (PORT_SET* set, PORT* from, void** data, int* len,
+		     BOOL* queued)
 {
-	PROCESS sender = NULL;
-
-	volatile int saved_if;
-	DISABLE_INTR(saved_if);
-
-	/* Find first message waiting */
-	PORT p = active_proc->first_port;
-	while(p != NULL)
+	PROCESS sender;
+	PORT p;
+	unsigned words, ready = 0;
+	int w, bit;
+
+	/* Find first message waiting, at most one look per word */
+	words = active_proc->ports_ready_words;
+	while (words != 0)
 	{
-		if (p->open && p->blocked_list_head != NULL)
+		HIGHEST_BIT(words, w);
+		ready = active_proc->ports_ready.word[w];
+		if (set != NULL)
+		{
+			ready &= set->word[w];
+		}
+		if (ready != 0)
 		{
-			/* Found first message */
-			/* remove that process from blocked list */
-			sender = p->blocked_list_head;
-			p->blocked_list_head = sender->next_blocked;
-			sender->next_blocked = NULL;
-			if(p->blocked_list_head == NULL)
-			{
-				p->blocked_list_tail = NULL;
-			}
 			break;
 		}
-		p = p->next;
+		words &= ~(1 << w);
+	}
+	if (ready == 0)
+	{
+		return NULL;
 	}
 
-	ENABLE_INTR(saved_if);
+	HIGHEST_BIT(ready, bit);
+	p = &port[w * 32 + bit];
+	*from = p;
+
+	if (p->mailbox != NULL && p->mailbox->depth > 0)
+	{
+		*queued = TRUE;
+		return get_mailbox(p, data, len);
+	}
+
+	/* remove first process from blocked list */
+	*queued = FALSE;
+	sender = p->blocked_list_head;
+	*data = sender->param_data;
+	*len = sender->param_len;
+	p->blocked_list_head = sender->next_blocked;
+	sender->next_blocked = NULL;
+	sender->blocked_on = NULL;
+	if(p->blocked_list_head == NULL)
+	{
+		p->blocked_list_tail = NULL;
+	}
+	update_port_pending(p);
 
 	return sender;
 }
@@ -256,43 +758,167 @@ PROCESS pop_message( void )
 
 void* receive (PROCESS* sender)
 {
-	void* mess = NULL;
+	return receive_buf(sender, NULL);
+}
 
-	volatile int saved_if;
-	DISABLE_INTR(saved_if);
 
-	/* take a message if one is waiting */
-	*sender = pop_message();
+/*
+ * take_message
+ *----------------------------------------------------------------------------
+ * Takes a message waiting for active_proc on a port in set (any port
+ * if NULL), if there is one, and stores it in the PCB of active_proc. Returns the sender
+ * or NULL. Must be called with interrupts disabled.
+ */
+PROCESS take_message (PORT_SET* set)
+{
+	PROCESS sender;
+	PORT from;
+	void* data;
+	int data_len;
+	BOOL queued;
+
+	sender = pop_message(set, &from, &data, &data_len, &queued);
 
-	if(*sender != NULL)
+	if(sender != NULL)
 	{
 		/* Message found */
-		/* data in sender PCB */
-		mess = (*sender)->param_data;
+		deliver_message(from, sender, data, data_len);
 
-		if((*sender)->state == STATE_MESSAGE_BLOCKED)
+		/* a queued sender did not wait for this message */
+		if (!queued)
 		{
-			add_ready_queue(*sender);
-		}
-		else if((*sender)->state == STATE_SEND_BLOCKED)
-		{
-			(*sender)->state = STATE_REPLY_BLOCKED;
+			if(sender->state == STATE_MESSAGE_BLOCKED)
+			{
+				add_ready_queue(sender);
+				release_server(sender);
+			}
+			else if(sender->state == STATE_SEND_BLOCKED)
+			{
+				sender->state = STATE_REPLY_BLOCKED;
+				sender->reply_from = active_proc;
+			}
 		}
 	}
-	else
+
+	return sender;
+}
+
+
+/*
+ * receive_from
+ *----------------------------------------------------------------------------
+ * Receives a message on one of the ports in set, or on any port if
+ * set is NULL, blocking until there is one. Stores the length given by the sender in *len and the port
+ * in *from, if not NULL.
+ */
+void* receive_from (PORT_SET* set, PROCESS* sender, int* len, PORT* from)
+{
+	void* mess = NULL;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	/* take a message if one is waiting */
+	*sender = take_message(set);
+
+	if(*sender == NULL)
 	{
 		/* Wait for a message */
 		remove_ready_queue(active_proc);
 		active_proc->state = STATE_RECEIVE_BLOCKED;
+		active_proc->ports_receiving = set;
 
 		ENABLE_INTR(saved_if);
 		resign();
 		DISABLE_INTR(saved_if);
 
 		/* Message received */
-		/* data in own PCB */
-		mess = active_proc->param_data;
 		*sender = active_proc->param_proc;
+		active_proc->ports_receiving = NULL;
+	}
+
+	/* data in own PCB */
+	mess = active_proc->param_data;
+	if (len != NULL)
+	{
+		*len = active_proc->param_len;
+	}
+	if (from != NULL)
+	{
+		*from = active_proc->param_port;
+	}
+	if (*sender != NULL)
+	{
+		TRACE(TRACE_RECEIVE, *sender - pcb, active_proc->param_port - port);
+	}
+
+	ENABLE_INTR(saved_if);
+
+	return mess;
+}
+
+
+/*
+ * receive_buf
+ *----------------------------------------------------------------------------
+ * Like receive(), but also stores the length given by the sender in
+ * *len (0 for send() and message()). len may be NULL.
+ */
+void* receive_buf (PROCESS* sender, int* len)
+{
+	return receive_from(NULL, sender, len, NULL);
+}
+
+
+/*
+ * receive_port
+ *----------------------------------------------------------------------------
+ * Like receive(), but only takes messages sent to port, which must be
+ * owned by the calling process.
+ */
+void* receive_port (PORT port, PROCESS* sender)
+{
+	PORT_SET set;
+
+	assert(port->owner == active_proc);
+	PORT_SET_CLEAR(set);
+	PORT_SET_ADD(set, port);
+	return receive_from(&set, sender, NULL, NULL);
+}
+
+
+/*
+ * receive_select
+ *----------------------------------------------------------------------------
+ * Like receive(), but only takes messages sent to one of the ports in
+ * *set, built with the PORT_SET macros from ports of the calling
+ * process. The set must not change until receive_select() returns. The port the message came in on is stored in *from, if
+ * not NULL.
+ */
+void* receive_select (PORT_SET* set, PROCESS* sender, PORT* from)
+{
+	return receive_from(set, sender, NULL, from);
+}
+
+
+/*
+ * try_receive
+ *----------------------------------------------------------------------------
+ * Like receive(), but never blocks. If no message is waiting, *sender
+ * is set to NULL and NULL is returned.
+ */
+void* try_receive (PROCESS* sender)
+{
+	void* mess = NULL;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	*sender = take_message(NULL);
+	if (*sender != NULL)
+	{
+		mess = active_proc->param_data;
+		TRACE(TRACE_RECEIVE, *sender - pcb, active_proc->param_port - port);
 	}
 
 	ENABLE_INTR(saved_if);
@@ -301,15 +927,68 @@ void* receive (PROCESS* sender)
 }
 
 
+/*
+ * receive_timeout
+ *----------------------------------------------------------------------------
+ * Like receive(), but gives up after ticks timer ticks. In that case
+ * *sender is set to NULL and NULL is returned. Needs the timer service.
+ */
+void* receive_timeout (PROCESS* sender, int ticks)
+{
+	void* mess;
+	TIMER t;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	mess = try_receive(sender);
+	if (*sender == NULL && ticks > 0)
+	{
+		t = add_timeout(active_proc, ticks);
+		mess = receive(sender);
+		cancel_timeout(t);
+	}
+
+	ENABLE_INTR(saved_if);
+
+	return mess;
+}
+
+
+/*
+ * receive_copy
+ *----------------------------------------------------------------------------
+ * Receives a message and copies at most buf_len bytes of it into buf.
+ * The copy is made while the sender is still blocked, so the sender may
+ * reuse its buffer as soon as it continues. Returns the length given
+ * by the sender, which may be larger than buf_len.
+ */
+int receive_copy (PROCESS* sender, void* buf, int buf_len)
+{
+	int len;
+
+	active_proc->recv_buf = buf;
+	active_proc->recv_buf_len = buf_len;
+	receive_buf(sender, &len);
+	active_proc->recv_buf = NULL;
+
+	return len;
+}
+
+
 void reply (PROCESS sender)
 {
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
+	TRACE(TRACE_REPLY, sender - pcb, 0);
 	
-	if (sender->state == STATE_REPLY_BLOCKED)
+	/* a killed sender's PCB may have been reused since */
+	if (sender->state == STATE_REPLY_BLOCKED && sender->reply_from == active_proc)
 	{
 		/* put sender back on ready queue */
+		sender->reply_from = NULL;
 		add_ready_queue(sender);
+		release_server(sender);
 	}
 
 	ENABLE_INTR(saved_if);
@@ -322,12 +1001,25 @@ void init_ipc()
 {
 	PORT p, end;
 
+	MAILBOX *m, *m_end;
+
 	/* initialize all ports as used = FALSE */
+	/* and put them on the free list */
+	free_port = NULL;
 	end = port + MAX_PORTS;
-	for (p = port; p < end; p++)
+	for (p = end - 1; p >= port; p--)
 	{
 		p->magic = MAGIC_PORT;
 		p->used = FALSE;
+		p->mailbox = NULL;
+		p->next = free_port;
+		free_port = p;
+	}
+
+	m_end = mailbox + MAX_MAILBOXES;
+	for (m = mailbox; m < m_end; m++)
+	{
+		m->used = FALSE;
 	}
 
 	/* Create port for boot process */
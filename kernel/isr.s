@@ -0,0 +1,106 @@
+/*
+ * Entry and exit code shared by all interrupt service routines.
+ *
+ * There is one stub per interrupt vector. Every stub is exactly
+ * ISR_STUB_SIZE (16) bytes long, so the stub of vector n is located at
+ * isr_stubs + 16 * n. A stub saves the context of the interrupted
+ * process with PUSHAL and jumps to isr_common with the vector number
+ * in %eax. isr_common calls
+ *
+ *	MEM_ADDR service_intr (int intr_no, MEM_ADDR context)
+ *
+ * which returns the saved stack pointer of the process to switch to,
+ * or 0 if the interrupted process continues to run. With SMP,
+ * service_intr() keeps the kernel lock when it switches processes, and
+ * isr_common releases it once it runs on the new stack. The context on
+ * the stack of a process therefore looks like this:
+ *
+ *	EFLAGS
+ *	CS
+ *	EIP
+ *	EAX, ECX, EDX, EBX, ESP (ignored), EBP, ESI, EDI	<- PCB.esp
+ */
+
+.text
+
+	.align 16
+.globl isr_stubs
+
+isr_stubs:
+	.set vector, 0
+	.rept 256			/* MAX_INTERRUPTS */
+	pushal
+	movl $vector, %eax
+	jmp isr_common
+	.align 16
+	.set vector, vector + 1
+	.endr
+
+
+	.align 4
+isr_common:
+	pushl %esp			/* context */
+	pushl %eax			/* intr_no */
+	call service_intr
+	addl $8, %esp
+	testl %eax, %eax
+	jz 1f
+	movl %eax, %esp			/* switch to the new process */
+	cmpl $0, smp_enabled
+	je 1f
+	call switch_done
+1:
+	popal
+	iret
+
+
+/*
+ * resign
+ *----------------------------------------------------------------------------
+ * The current process gives up the CPU voluntarily. The
+ * next running process is determined via dispatcher().
+ * The stack of the calling process is setup such that it
+ * looks like an interrupt.
+ */
+
+	.align 4
+.globl resign
+
+resign:
+	pushfl
+	cli
+	popl %eax
+	xchgl (%esp), %eax		/* EFLAGS replaces the return address */
+	pushl %cs
+	pushl %eax			/* EIP */
+	pushal
+	movl $-1, %eax			/* no interrupt to service */
+	jmp isr_common
+
+
+/*
+ * fork_context
+ *----------------------------------------------------------------------------
+ * Pushes the context of the caller like resign() does and passes it
+ * to fork_process(), which copies the stack into a new process. The
+ * parent gets the child back in EAX. The child starts out on the
+ * copied context, where EAX is 0, and returns from the same call.
+ */
+
+	.align 4
+.globl fork_context
+
+fork_context:
+	pushfl
+	cli
+	pushl %cs
+	pushl $1f			/* EIP */
+	pushal
+	pushl %esp			/* context */
+	call fork_process
+	addl $4, %esp
+	movl %eax, 28(%esp)		/* EAX of the PUSHAL frame */
+	popal
+	iret
+1:
+	ret
@@ -160,8 +160,6 @@ unsigned get_keycode (unsigned char ch)
 
 void keyb_notifier (PROCESS self, PARAM param)
 {
-    Keyb_Message msg;
-    
     while (1) {
 	wait_for_interrupt (KEYB_IRQ);
 	
@@ -260,9 +258,9 @@ void keyb_notifier (PROCESS self, PARAM param)
 	
 	if (!done && ((new_key = get_keycode (new_char)) != 0)) {
 	    /* we actually have a new keystroke. Send it to the
-	       keyboard process */
-	    msg.key_buffer = (char*) &new_key;
-	    message (keyb_port, &msg);
+	       keyboard process. The message is queued, so the key
+	       is passed by value */
+	    message (keyb_port, (void*) new_key);
 	}
 	
 	if (special) special--;      /* these decrements will allow the */
@@ -286,7 +284,8 @@ void keyb_process (PROCESS self, PARAM param)
     Keyb_Message* client_msg;
     
     keyb_notifier_port =
-	create_process (keyb_notifier, 7, 0, "Keyboard Notifier");
+	create_process_stack (keyb_notifier, 7, 0, "Keyboard Notifier",
+			      SMALL_STACK_SIZE);
     keyb_notifier_proc = keyb_notifier_port->owner;
 
     client_proc = NULL;
@@ -302,13 +301,13 @@ void keyb_process (PROCESS self, PARAM param)
 	    if (client_proc != NULL) {
 		/* and there is a client waiting. Just return
 		   the keystroke to the client. */
-		*client_msg->key_buffer = *msg->key_buffer;
+		*client_msg->key_buffer = (char) (unsigned) msg;
 		reply (client_proc);
 		client_proc = NULL;
 	    } else {
 		/* no client is waiting. Save the keystroke.
 		   Note that we should use a queue here. */
-		key_buffer = *msg->key_buffer;
+		key_buffer = (char) (unsigned) msg;
 		key_waiting = TRUE;
 	    }
 	} else {
@@ -336,5 +335,6 @@ void init_keyb()
 {
     keyb_port = create_process (keyb_process, 6, 0,
 				"Keyboard Process");
+    create_mailbox (keyb_port, FALSE);
     resign();
 }
@@ -0,0 +1,153 @@
+#include <kernel.h>
+
+/*
+ * Kernel log. kprintf() formats into a line of at most
+ * KLOG_LINE_SIZE - 1 characters and appends it to a ring of
+ * KLOG_LINES lines. Like in the event trace, a slot is claimed with a
+ * single lock xadd on klog_next, so kprintf() needs neither a lock
+ * nor disabled interrupts and can be used in interrupt handlers and
+ * in the dispatcher. The writer commits a line by storing its
+ * sequence number after the text. When the ring is full the oldest
+ * lines are overwritten.
+ *
+ * init_klog() starts the drain, an idle job of the null process that
+ * copies the new lines to kernel_window, and to COM2 if klog_com2 is
+ * set. The lines stay in the ring after that, so dmesg can print them
+ * again after the screen was cleared.
+ */
+
+/* lines the drain copies per slice of the null process */
+#define KLOG_DRAIN_LINES	4
+
+KLOG_LINE klog_ring[KLOG_LINES];
+volatile unsigned klog_next;
+
+/* first line the drain did not copy yet */
+unsigned klog_drained;
+/* lines overwritten before the drain got to them */
+unsigned klog_lost;
+
+BOOL klog_drain = FALSE;
+BOOL klog_com2 = FALSE;
+
+
+/*
+ * klog_write
+ *----------------------------------------------------------------------------
+ * Appends text to the ring, cut off at KLOG_LINE_SIZE - 1 characters.
+ */
+void klog_write(const char *text)
+{
+	KLOG_LINE *line;
+	unsigned i = 1;
+	int len = min(k_strlen(text), KLOG_LINE_SIZE - 1);
+
+	asm volatile ("lock xaddl %0, %1" : "+r" (i), "+m" (klog_next));
+	line = &klog_ring[i & (KLOG_LINES - 1)];
+	line->seq = 0;
+	asm volatile ("" : : : "memory");
+	k_memcpy(line->text, text, len);
+	line->text[len] = '\0';
+	asm volatile ("" : : : "memory");
+	line->seq = i + 1;
+
+	if (klog_drain)
+		kick_idle_job(klog_job);
+}
+
+
+/*
+ * klog_read
+ *----------------------------------------------------------------------------
+ * Copies line i to buf, which has room for KLOG_LINE_SIZE characters.
+ * Returns FALSE if line i is not committed yet or was overwritten,
+ * also while it was copied.
+ */
+BOOL klog_read(unsigned i, char *buf)
+{
+	KLOG_LINE *line = &klog_ring[i & (KLOG_LINES - 1)];
+
+	if (line->seq != i + 1)
+		return FALSE;
+	k_memcpy(buf, line->text, KLOG_LINE_SIZE);
+	asm volatile ("" : : : "memory");
+	return line->seq == i + 1;
+}
+
+
+/*
+ * klog_job
+ *----------------------------------------------------------------------------
+ * The drain. Copies up to KLOG_DRAIN_LINES new lines to kernel_window
+ * and COM2. Stops at a line that is not committed yet; its writer
+ * kicks the job again.
+ */
+BOOL klog_job(void* data)
+{
+	char buf[KLOG_LINE_SIZE];
+	unsigned next = klog_next;
+	int n;
+
+	if (next - klog_drained > KLOG_LINES)
+	{
+		klog_lost += next - klog_drained - KLOG_LINES;
+		klog_drained = next - KLOG_LINES;
+	}
+
+	for (n = 0; n < KLOG_DRAIN_LINES && klog_drained != next; n++)
+	{
+		if (!klog_read(klog_drained, buf))
+		{
+			// overwritten lines are skipped with the next call
+			return klog_next - klog_drained > KLOG_LINES;
+		}
+		output_string(kernel_window, buf);
+		if (klog_com2)
+			write_com2(buf, k_strlen(buf));
+		klog_drained++;
+	}
+	return klog_drained != klog_next;
+}
+
+
+// drains the log right away, for panics
+void klog_flush()
+{
+	if (klog_drain)
+		while (klog_job(NULL));
+}
+
+
+// prints the lines still in the ring to wnd, returns their number
+int klog_print(WINDOW* wnd)
+{
+	char buf[KLOG_LINE_SIZE];
+	unsigned next = klog_next;
+	unsigned i = (next > KLOG_LINES) ? next - KLOG_LINES : 0;
+	int n = 0;
+
+	for ( ; i != next; i++)
+	{
+		if (klog_read(i, buf))
+		{
+			output_string(wnd, buf);
+			n++;
+		}
+	}
+	return n;
+}
+
+
+/*
+ * init_klog
+ *----------------------------------------------------------------------------
+ * Starts the drain. kprintf() no longer writes to the screen itself.
+ * Must be called after init_null_process().
+ */
+void init_klog()
+{
+	klog_drained = klog_next;
+	klog_lost = 0;
+	add_idle_job(klog_job, NULL);
+	klog_drain = TRUE;
+}
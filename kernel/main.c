@@ -11,6 +11,9 @@ void kernel_main()
     outportb(0x03D4, 0x0F);
     outportb(0x03D5, 0xFF);
 
+#ifdef SMP
+    init_cpu_segments();
+#endif
     clear_window(kernel_window);
 
     init_process();
@@ -18,9 +21,19 @@ void kernel_main()
     init_ipc();
     init_interrupts();
     init_null_process();
+    init_pit(TIMER_HZ);
     init_timer();
+    // from now on the timer tick flushes the console,
+    // and the kernel window scrolls in hardware
+    console_deferred = TRUE;
+    console_panning = TRUE;
+    // kprintf() only appends to the log, the null process shows it
+    init_klog();
+#ifdef SMP
+    init_smp();
+#endif
 
-    // tos_splash_screen(1000);
+    // tos_splash_screen(54925);
 
     init_com();
     init_keyb();
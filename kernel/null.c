@@ -1,68 +1,253 @@
-
 #include <kernel.h>
 
+/*
+ * The null process runs whenever no other process is ready. It
+ *  1. kills the processes that called exit(),
+ *  2. runs one slice of every idle job that has work,
+ *  3. halts until the next interrupt if there is nothing else to do.
+ * Idle jobs must keep their slices short; the null process can be
+ * preempted between slices but the job may disable interrupts within
+ * a slice.
+ */
+
 // determines location to print primes
 static WINDOW null_window_def = {68, 0, 12, 1, 0, 0, ' '};
 WINDOW* null_window = &null_window_def;
 
 volatile unsigned int null_prime;
-volatile BOOL prime_reset;
-volatile unsigned int new_start;
 
-volatile PROCESS process_to_kill;
+typedef struct _idle_job_def
+{
+	IDLE_JOB job;
+	void* data;
+	BOOL pending;		/* has work, job() is called */
+} idle_job_def;
+
+idle_job_def idle_jobs[MAX_IDLE_JOBS];
 
-void null_process(PROCESS proc, PARAM param)
+// processes that called exit(), linked through next
+PROCESS reap_head;
+PROCESS reap_tail;
+
+
+/*
+ * add_reap_queue
+ *----------------------------------------------------------------------------
+ * Hands a process that is no longer on the ready queue to the null
+ * process, which kills it. Any number of processes can be pending.
+ */
+void add_reap_queue(PROCESS proc)
 {
-	// WORD *pos = (WORD*)WINDOW_BASE_ADDR + WINDOW_OFFSET(null_window, null_window->cursor_x, null_window->cursor_y) + 11;
-	unsigned int i = 3;
-	unsigned int j;
-	prime_reset = TRUE;
-	new_start = param;
-	null_prime = 2;
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
-	// int done = FALSE;
+	proc->next = NULL;
+	if (reap_head == NULL)
+	{
+		reap_head = proc;
+	}
+	else
+	{
+		reap_tail->next = proc;
+	}
+	reap_tail = proc;
 
-	while(1)
+	ENABLE_INTR(saved_if);
+}
+
+// takes proc off the reap queue, if it is on it
+void remove_reap_queue(PROCESS proc)
+{
+	PROCESS p, prev = NULL;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	for (p = reap_head; p != NULL && p != proc; p = p->next)
+	{
+		prev = p;
+	}
+	if (p != NULL)
 	{
-		if (process_to_kill != NULL)
+		if (prev == NULL)
 		{
-			kill_process(process_to_kill, TRUE);
-			process_to_kill = NULL;
+			reap_head = p->next;
 		}
+		else
+		{
+			prev->next = p->next;
+		}
+		if (reap_tail == p)
+		{
+			reap_tail = prev;
+		}
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+void reap_processes()
+{
+	PROCESS proc, next;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	proc = reap_head;
+	reap_head = NULL;
+	reap_tail = NULL;
+	while (proc != NULL)
+	{
+		next = proc->next;
+		// still switching out on another CPU: try again next time
+		if (!kill_process(proc, TRUE) && proc->used)
+		{
+			add_reap_queue(proc);
+		}
+		proc = next;
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * add_idle_job
+ *----------------------------------------------------------------------------
+ * Registers a background job. The null process calls job(data) while
+ * the job is pending; job() does a small amount of work and returns
+ * FALSE once it has nothing more to do. kick_idle_job() makes it
+ * pending again. New jobs start pending.
+ */
+void add_idle_job(IDLE_JOB job, void* data)
+{
+	idle_job_def *j;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
-		if (prime_reset == TRUE)
+	for (j = idle_jobs; j < idle_jobs + MAX_IDLE_JOBS && j->job != NULL; j++);
+	assert(j < idle_jobs + MAX_IDLE_JOBS);
+	j->job = job;
+	j->data = data;
+	j->pending = TRUE;
+
+	ENABLE_INTR(saved_if);
+}
+
+void kick_idle_job(IDLE_JOB job)
+{
+	idle_job_def *j;
+
+	for (j = idle_jobs; j < idle_jobs + MAX_IDLE_JOBS; j++)
+	{
+		if (j->job == job)
 		{
-			i = (new_start > 2) ? new_start + 1 - new_start%2 : 3;
-			prime_reset = FALSE;
+			j->pending = TRUE;
 		}
+	}
+}
 
-		// compute primes
-		for(j = 3; j*j <= i; j += 2)
+// runs one slice of every pending job, returns TRUE if work is left
+BOOL run_idle_jobs()
+{
+	idle_job_def *j;
+	BOOL work_left = FALSE;
+
+	for (j = idle_jobs; j < idle_jobs + MAX_IDLE_JOBS; j++)
+	{
+		if (j->job != NULL && j->pending)
 		{
-			if(i % j == 0)
+			// clear first, so a kick during the slice is not lost
+			j->pending = FALSE;
+			if (j->job(j->data))
 			{
-				i += 2;
-				j = 3;
+				j->pending = TRUE;
 			}
 		}
-		null_prime = i;
+		work_left |= j->pending;
+	}
+	return work_left;
+}
+
+
+// the prime search, one candidate per slice
+unsigned int prime_candidate;
+
+BOOL prime_job(void* data)
+{
+	unsigned int j;
+
+	for (j = 3; j*j <= prime_candidate; j += 2)
+	{
+		if (prime_candidate % j == 0)
+		{
+			prime_candidate += 2;
+			return TRUE;
+		}
+	}
+	null_prime = prime_candidate;
+	return FALSE;
+}
 
-		// wprintf(null_window, "\n%u", i);
+/*
+ * find_prime
+ *----------------------------------------------------------------------------
+ * Lets the null process search for the first prime >= start in the
+ * background. The result ends up in null_prime.
+ */
+void find_prime(unsigned int start)
+{
+	if (start <= 2)
+	{
+		null_prime = 2;
+		return;
+	}
+	prime_candidate = start | 1;
+	kick_idle_job(prime_job);
+}
 
-		// print primes faster
-		// for (j=i; pos >= (WORD*)WINDOW_BASE_ADDR + WINDOW_OFFSET(null_window, null_window->cursor_x, null_window->cursor_y); pos--, j/=10)
-		// {
-		// 	poke_w((MEM_ADDR)pos, ('0' + (j % 10)) | 0x0F00);
-		// }
-		// pos += 12;
 
-		i += 2;
+void null_process(PROCESS proc, PARAM param)
+{
+	find_prime(param);
+
+	while(1)
+	{
+		reap_processes();
+
+		if (run_idle_jobs() || !interrupts_initialized)
+			continue;
+
+		// the tick that would flush the console may be stopped
+		flush_console();
+
+		// nothing else to do: halt until the next interrupt
+		// sti only takes effect after hlt, so no interrupt is missed
+		asm("cli");
+		if (reap_head == NULL)
+		{
+			enter_tickless_idle();
+			asm("sti; hlt");
+		}
+		asm("sti");
 	}
 }
 
 void init_null_process()
 {
-	process_to_kill = NULL;
+	int i;
+
+	reap_head = NULL;
+	reap_tail = NULL;
+	for (i = 0; i < MAX_IDLE_JOBS; i++)
+	{
+		idle_jobs[i].job = NULL;
+		idle_jobs[i].pending = FALSE;
+	}
+	null_prime = 2;
+	add_idle_job(prime_job, NULL);
+	add_idle_job(clean_stacks_job, NULL);
 
-	create_process (null_process, 0, 456198994, "Null process");
+	create_process_stack (null_process, 0, 456198994, "Null process", SMALL_STACK_SIZE);
 }
@@ -1,7 +1,7 @@
 
 #include <kernel.h>
 
-unsigned int ghost_sleep = 0x38;
+unsigned int ghost_sleep = 3076;	// milliseconds, 0x38 ticks at 18.2 Hz
 
 typedef struct {
     int x;
@@ -160,10 +160,12 @@ void move_ghost(GHOST *ghost)
 void create_new_ghost()
 {
     GHOST ghost;
+    TIMER timer;
     init_ghost(&ghost);
+    timer = periodic_timer(ms_to_ticks(ghost_sleep));
     while(1)
     {
-        sleep(ghost_sleep);
+        wait_periodic(timer);
         move_ghost(&ghost);
     }
 }
@@ -193,6 +195,6 @@ void init_pacman(WINDOW* wnd, int num_ghosts)
 
     int j;
     for (j = 0; j < num_ghosts; j++)
-        create_process(ghost_proc, 3, 0, "Ghost");
+        create_process_stack(ghost_proc, 3, 0, "Ghost", SMALL_STACK_SIZE);
 }
 
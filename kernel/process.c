@@ -2,47 +2,93 @@
 #include <kernel.h>
 
 
+/* Stack of the boot process, set up in startup.s */
 #define STACK_TOP (640*1024)
-#define FRAME_SIZE (30*1024)
+#define BOOT_STACK_SIZE (30*1024)
 
 PCB pcb[MAX_PROCS];
 
+/* Unused PCBs, linked through next */
+PROCESS free_pcb;
+
 
 PORT create_process (void (*ptr_to_new_proc) (PROCESS, PARAM),
 		     int prio,
 		     PARAM param,
 		     char *name)
 {
-	MEM_ADDR esp;
-	PORT prt;
-	PROCESS proc;
-	PROCESS end = pcb + MAX_PROCS;
+	return create_process_stack(ptr_to_new_proc, prio, param, name,
+				    DEFAULT_STACK_SIZE);
+}
 
-	volatile int saved_if;
-	DISABLE_INTR(saved_if);
+
+/*
+ * alloc_process
+ *----------------------------------------------------------------------------
+ * Takes a PCB off the free list and gives it a stack of at least
+ * stack_size bytes. The caller sets up the stack frame and adds the
+ * process to the ready queue. Must be called with interrupts disabled.
+ */
+PROCESS alloc_process (int prio, char *name, int stack_size)
+{
+	PROCESS proc;
 
 	assert(prio < MAX_READY_QUEUES && prio >= 0);
 
 	/* Allocate available PCB */
-	for (proc = pcb; proc < end; proc++)
-	{
-		if (proc->used == FALSE)
-		{
-			break;
-		}
-	}
-	assert(proc != end);
+	proc = free_pcb;
+	assert(proc != NULL);
+	free_pcb = proc->next;
 
 	/* Initialize PCB */
 	proc->magic 		= MAGIC_PCB;
 	proc->used 			= TRUE;
 	proc->state 		= STATE_READY;
 	proc->priority 		= prio;
+	proc->base_priority	= prio;
+	proc->server		= NULL;
+	k_memset(proc->lenders, 0, sizeof(proc->lenders));
 	proc->first_port 	= NULL;
 	proc->name 			= name;
+	proc->on_ready_queue = FALSE;
+	proc->param_len		= 0;
+	proc->recv_buf		= NULL;
+	PORT_SET_CLEAR(proc->ports_ready);
+	proc->ports_ready_words = 0;
+	proc->ports_pending	= 0;
+	proc->ports_receiving = NULL;
+	proc->blocked_on	= NULL;
+	proc->reply_from	= NULL;
+	proc->ipc_failed	= FALSE;
+	proc->cpu			= -1;
+	proc->lock_depth	= 0;
+	proc->generation++;
+	init_proc_stats(proc);
 
 	/* Allocate stack frame */
-	esp = STACK_TOP - (proc - pcb) * FRAME_SIZE;
+	proc->stack_base	= alloc_stack(stack_size);
+	assert(proc->stack_base != (MEM_ADDR)NULL);
+	proc->stack_size	= stack_block_size(proc->stack_base);
+
+	return proc;
+}
+
+
+PORT create_process_stack (void (*ptr_to_new_proc) (PROCESS, PARAM),
+			   int prio,
+			   PARAM param,
+			   char *name,
+			   int stack_size)
+{
+	MEM_ADDR esp;
+	PORT prt;
+	PROCESS proc;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	proc = alloc_process(prio, name, stack_size);
+	esp = proc->stack_base + proc->stack_size;
 
 	/* initialize stack frame */
 	esp -= 4; /* param */
@@ -71,6 +117,8 @@ PORT create_process (void (*ptr_to_new_proc) (PROCESS, PARAM),
 	poke_l(esp, 0);
 	esp -= 4; /* EBX */
 	poke_l(esp, 0);
+	esp -= 4; /* ESP, ignored by POPAL */
+	poke_l(esp, 0);
 	esp -= 4; /* EBP */
 	poke_l(esp, 0);
 	esp -= 4; /* ESI */
@@ -93,23 +141,51 @@ PORT create_process (void (*ptr_to_new_proc) (PROCESS, PARAM),
 	return prt;
 }
 
+/*
+ * kill_process
+ *----------------------------------------------------------------------------
+ * Removes proc from the system, whatever it is blocked on. Processes
+ * that wait for proc to receive or reply to their message continue,
+ * with send() or message() returning FALSE. A process cannot kill
+ * itself, it calls exit() instead. Unless force is TRUE, the null
+ * process and processes with messages waiting are not killed.
+ */
 BOOL kill_process (PROCESS proc, BOOL force)
 {
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	if ((active_proc != proc
-		 &&	proc->state == STATE_READY
-		 &&	!check_messages(proc)
+#ifdef SMP
+	/* running here or on another CPU */
+	if (proc->used != TRUE || proc->cpu >= 0)
+#else
+	if (proc->used != TRUE || proc == active_proc)
+#endif
+	{
+		ENABLE_INTR(saved_if);
+
+		/* nothing to kill */
+		return FALSE;
+	}
+
+	if ((!check_messages(proc)
 		 && proc->priority != 0)
 		 || force)
 	{
 		/* remove process from ready queue */
 		remove_ready_queue(proc);
+		remove_reap_queue(proc);
+
+		/* Wake up its peers, leave other ports */
+		release_ipc(proc);
 
 		/* Deallocate ports */
 		remove_ports(proc);
 
+		/* Deallocate timers and interrupts */
+		release_timers(proc);
+		release_interrupts(proc);
+
 		/* Deallocate PCB */
 		proc->magic 		= ~MAGIC_PCB;
 		proc->used 			= FALSE;
@@ -121,6 +197,14 @@ BOOL kill_process (PROCESS proc, BOOL force)
 		/* destroy stack pointer */
 		proc->esp = (MEM_ADDR)NULL;
 
+		/* Deallocate stack */
+		free_stack(proc->stack_base);
+		proc->stack_base = (MEM_ADDR)NULL;
+
+		/* Return PCB to the free list */
+		proc->next = free_pcb;
+		free_pcb = proc;
+
 		ENABLE_INTR(saved_if);
 
 		/* kill successful */
@@ -152,20 +236,88 @@ PROCESS get_proc_by_name(char *name)
 	return NULL;
 }
 
-// gives the null process the message to kill the other process
+// hands the calling process to the null process, which kills it
 void exit()
 {
-	process_to_kill = active_proc;
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
 	remove_ready_queue(active_proc);
+	add_reap_queue(active_proc);
 
 	resign();
 }
 
+/*
+ * fork
+ *----------------------------------------------------------------------------
+ * Creates a copy of the calling process, with the same priority, name
+ * and a copy of its stack. The child also gets a new port of its own.
+ * fork() returns the child to the parent and NULL to the child, which
+ * continues once it is dispatched.
+ *
+ * The kernel is compiled without frame pointers, so there is no EBP
+ * chain to follow. Instead every word of the copied stack, saved
+ * registers included, that points into the used part of the parent's
+ * stack is moved to the same place in the child's stack. Pointers to
+ * locals kept elsewhere (e.g. in globals) still refer to the parent.
+ * The self argument of the process function still names the parent;
+ * the child finds its PCB in active_proc.
+ */
 PROCESS fork()
 {
-    // Dummy return to make gcc happy
-    return (PROCESS) NULL;
+	return fork_context();
+}
+
+
+/*
+ * fork_process
+ *----------------------------------------------------------------------------
+ * Called by fork_context() with interrupts disabled. context is the
+ * stack pointer of active_proc after its context was pushed like for
+ * resign(). Returns the child, whose saved EAX is 0. The critical
+ * section also takes the kernel lock under SMP, where cli alone does
+ * not keep other CPUs away from the free PCBs.
+ */
+PROCESS fork_process (MEM_ADDR context)
+{
+	PROCESS child;
+	MEM_ADDR top, child_top, p;
+	LONG value;
+	int delta;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	child = alloc_process(active_proc->base_priority, active_proc->name,
+			      active_proc->stack_size);
+
+	top = active_proc->stack_base + active_proc->stack_size;
+	child_top = child->stack_base + child->stack_size;
+	assert(top - context <= child->stack_size);
+
+	/* same distance from the top of the stack as in the parent */
+	delta = child_top - top;
+	child->esp = context + delta;
+	k_memcpy((void*) child->esp, (void*) context, top - context);
+
+	for (p = child->esp; p < child_top; p += 4)
+	{
+		value = peek_l(p);
+		if (value >= context && value < top)
+		{
+			poke_l(p, value + delta);
+		}
+	}
+
+	/* EAX of the PUSHAL frame, fork() returns NULL in the child */
+	poke_l(child->esp + 28, 0);
+
+	add_ready_queue(child);
+	create_new_port(child);
+
+	ENABLE_INTR(saved_if);
+	return child;
 }
 
 
@@ -241,13 +393,24 @@ void print_all_processes(WINDOW* wnd)
 void init_process()
 {
 	PROCESS proc, end;
+	MEM_ADDR esp;
+
+	init_stacks();
 
 	/* initialize all pcbs as used = FALSE */
+	/* and put all but the boot process on the free list */
+	free_pcb = NULL;
 	end = pcb + MAX_PROCS;
-	for (proc = pcb; proc < end; proc++)
+	for (proc = end - 1; proc >= pcb; proc--)
 	{
 		proc->magic = ~MAGIC_PCB;
 		proc->used = FALSE;
+		proc->on_ready_queue = FALSE;
+		if (proc != pcb)
+		{
+			proc->next = free_pcb;
+			free_pcb = proc;
+		}
 	}
 
 	/* setup initial/null process */
@@ -255,9 +418,34 @@ void init_process()
 	pcb->used 		= TRUE;
 	pcb->state 		= STATE_READY;
 	pcb->priority 	= 1;
+	pcb->base_priority = 1;
+	pcb->server		= NULL;
+	k_memset(pcb->lenders, 0, sizeof(pcb->lenders));
 	pcb->first_port = NULL;
 	pcb->name 		= boot_name;
+	pcb->param_len	= 0;
+	pcb->recv_buf	= NULL;
+	PORT_SET_CLEAR(pcb->ports_ready);
+	pcb->ports_ready_words = 0;
+	pcb->ports_pending = 0;
+	pcb->ports_receiving = NULL;
+	pcb->blocked_on	= NULL;
+	pcb->reply_from	= NULL;
+	pcb->ipc_failed	= FALSE;
+	pcb->cpu		= 0;
+	pcb->lock_depth	= 0;
+	init_proc_stats(pcb);
+	pcb->stack_base = STACK_TOP - BOOT_STACK_SIZE;
+	pcb->stack_size = BOOT_STACK_SIZE;
+
+	/* fill the unused part of the boot stack, which we are running on */
+	asm ("movl %%esp, %0" : "=r" (esp));
+	fill_stack_canary(pcb->stack_base, esp);
 
 	/* initialize active process to initial/null process */
+#ifdef SMP
+	cpus[0].current = pcb;
+#else
 	active_proc = pcb;
+#endif
 }
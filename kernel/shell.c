@@ -394,8 +394,8 @@ int pacman_func(int argc, char **argv)
 	}
 }
 
-// prints a prime generated in the null process
-// if given an argument resets the prime currently being worked on in the null process to arg[1]
+// prints the last prime found by the null process
+// if given an argument the null process searches for the first prime >= arg[1]
 int prime_func(int argc, char **argv)
 {
 	if (argc == 1)
@@ -406,8 +406,7 @@ int prime_func(int argc, char **argv)
 	{
 		if (is_num(argv[1]))
 		{
-			prime_reset = TRUE;
-			new_start = atoi(argv[1]);
+			find_prime(atoi(argv[1]));
 		}
 		else
 		{
@@ -437,9 +436,9 @@ int train_func(int argc, char **argv)
 }
  
 // kills the process corresponding to the number in argv[1]
-// does not kill the null process, or a process in any waiting state
+// never kills the shell itself, and does not kill the null process
 // or a process with a message in one of its ports
-// if argv[2] is -f forces kill
+// unless argv[2] is -f
 int kill_func(int argc, char **argv)
 {
 	BOOL force = FALSE;
@@ -458,7 +457,7 @@ int kill_func(int argc, char **argv)
 			if (k_strcmp("-f", argv[2]) == 0)
 				force = TRUE;
 
-		if (kill_process(pcb + proc_num, force))
+		if (proc_num < MAX_PROCS && kill_process(pcb + proc_num, force))
 		{
 			wprintf(shell_wnd, "Kill Success\n");
 		} 
@@ -475,6 +474,183 @@ int kill_func(int argc, char **argv)
 	}
 }
 
+// prints the stack size and deepest stack usage of every process
+int stackstat_func(int argc, char **argv)
+{
+	PROCESS proc;
+	int used;
+
+	wprintf(shell_wnd, "Num \tSize \tUsed \t%%  \tName\n");
+	wprintf(shell_wnd, "--------------------------------------------\n");
+
+	for (proc = pcb; proc < pcb + MAX_PROCS; proc++)
+	{
+		if (proc->used != TRUE)
+			continue;
+
+		used = stack_high_water(proc->stack_base, proc->stack_size);
+		wprintf(shell_wnd, "%4d\t%5d\t%5d\t%3d\t%s\n", proc - pcb,
+			proc->stack_size, used, used * 100 / proc->stack_size, proc->name);
+	}
+	return 0;
+}
+
+// prints the fill level and drops of every mailbox
+int mbox_func(int argc, char **argv)
+{
+	PORT p;
+
+	wprintf(shell_wnd, "Port	Depth	Max  	Drops	Owner\n");
+	wprintf(shell_wnd, "--------------------------------------------\n");
+
+	for (p = port; p < port + MAX_PORTS; p++)
+	{
+		if (p->used != TRUE || p->mailbox == NULL)
+			continue;
+
+		wprintf(shell_wnd, "%4d\t%5d\t%5d\t%5d\t%s\n", p - port,
+			p->mailbox->depth, p->mailbox->max_depth,
+			p->mailbox->drops, p->owner->name);
+	}
+	return 0;
+}
+
+// counters of every process at the last refresh of top, and the
+// generation of the PCB they were taken from
+PROC_STATS top_last[MAX_PROCS];
+unsigned top_generation[MAX_PROCS];
+
+// percentage of interval ticks spent between two counter values
+int top_percent(unsigned now, unsigned last, int interval)
+{
+	return (now - last) * 100 / interval;
+}
+
+// shows the CPU usage of all processes every argv[1] ticks, argv[2] times
+// all columns are for the last interval, times are percentages of it
+int top_func(int argc, char **argv)
+{
+	static const char *state_name[NUM_STATES] = {"Rdy", "Snd", "Rpl", "Rcv", "Msg", "Int"};
+	PROC_STATS stats;
+	PROC_STATS *last;
+	PROCESS proc;
+	TIMER timer;
+	int interval = ms_to_ticks(1000);
+	int iterations = 10;
+	int i, s;
+
+	if (argc > 1)
+	{
+		if (!is_num(argv[1]) || atoi(argv[1]) <= 0)
+		{
+			wprintf(shell_wnd, "Usage: top [ticks [iterations]]\n");
+			return 1;
+		}
+		interval = atoi(argv[1]);
+	}
+	if (argc > 2 && is_num(argv[2]))
+	{
+		iterations = atoi(argv[2]);
+	}
+
+	for (proc = pcb; proc < pcb + MAX_PROCS; proc++)
+	{
+		get_proc_stats(proc, &top_last[proc - pcb]);
+		top_generation[proc - pcb] = proc->generation;
+	}
+
+	timer = periodic_timer(interval);
+	for (i = 0; i < iterations; i++)
+	{
+		wait_periodic(timer);
+
+		clear_window(shell_wnd);
+		wprintf(shell_wnd, "Num CPU  Disp  Vol  Pre");
+		for (s = 0; s < NUM_STATES; s++)
+		{
+			wprintf(shell_wnd, " %s", state_name[s]);
+		}
+		wprintf(shell_wnd, " Name\n");
+
+		for (proc = pcb; proc < pcb + MAX_PROCS; proc++)
+		{
+			if (proc->used != TRUE)
+				continue;
+
+			last = &top_last[proc - pcb];
+			if (top_generation[proc - pcb] != proc->generation)
+			{
+				// a new process in this slot, it started from 0
+				k_memset(last, 0, sizeof(PROC_STATS));
+				top_generation[proc - pcb] = proc->generation;
+			}
+			get_proc_stats(proc, &stats);
+			wprintf(shell_wnd, "%3d %3d %5d %4d %4d", proc - pcb,
+				top_percent(stats.cpu_ticks, last->cpu_ticks, interval),
+				stats.dispatches - last->dispatches,
+				stats.voluntary - last->voluntary,
+				stats.preempted - last->preempted);
+			for (s = 0; s < NUM_STATES; s++)
+			{
+				wprintf(shell_wnd, " %3d", top_percent(stats.state_ticks[s],
+					last->state_ticks[s], interval));
+			}
+			wprintf(shell_wnd, " %s\n", proc->name);
+			k_memcpy(last, &stats, sizeof(PROC_STATS));
+		}
+	}
+	cancel_periodic(timer);
+	return 0;
+}
+
+// controls the kernel event trace
+// 'dump' sends the trace to COM2 for tools/trace/trace2json.py
+int trace_func(int argc, char **argv)
+{
+	if (argc > 1 && k_strcmp(argv[1], "on") == 0)
+	{
+		trace_start();
+	}
+	else if (argc > 1 && k_strcmp(argv[1], "off") == 0)
+	{
+		trace_stop();
+	}
+	else if (argc > 1 && k_strcmp(argv[1], "dump") == 0)
+	{
+		wprintf(shell_wnd, "Sending trace to COM2... ");
+		wprintf(shell_wnd, "%d records\n", trace_dump());
+	}
+	else
+	{
+		wprintf(shell_wnd, "Usage: trace on|off|dump\n");
+		return 1;
+	}
+	return 0;
+}
+
+int dmesg_func(int argc, char **argv)
+{
+	if (argc == 1)
+	{
+		klog_print(shell_wnd);
+		if (klog_lost != 0)
+		{
+			wprintf(shell_wnd, "%d lines were lost\n", klog_lost);
+		}
+	}
+	else if (argc == 3 && k_strcmp(argv[1], "com2") == 0
+		 && (k_strcmp(argv[2], "on") == 0 || k_strcmp(argv[2], "off") == 0))
+	{
+		klog_com2 = k_strcmp(argv[2], "on") == 0;
+	}
+	else
+	{
+		wprintf(shell_wnd, "Usage: dmesg [com2 on|off]\n");
+		return 1;
+	}
+	return 0;
+}
+
 int tos_splash_func(int argc, char **argv)
 {
 	if (argc < 2)
@@ -511,6 +687,11 @@ void init_shell()
 	init_command("train", train_func, "Train related commands, see train help", &shell_cmd[i++]);
 	init_command("kill", kill_func, "Kill a process", &shell_cmd[i++]);
 	init_command("splash", tos_splash_func, "Display TOS splash screen in VGA mode", &shell_cmd[i++]);
+	init_command("stackstat", stackstat_func, "Prints stack usage of all processes", &shell_cmd[i++]);
+	init_command("mbox", mbox_func, "Prints mailbox usage of all ports", &shell_cmd[i++]);
+	init_command("top", top_func, "Shows CPU usage of all processes every argv[1] ticks", &shell_cmd[i++]);
+	init_command("trace", trace_func, "Starts, stops or dumps the kernel event trace to COM2", &shell_cmd[i++]);
+	init_command("dmesg", dmesg_func, "Prints the kernel log, or copies it to COM2", &shell_cmd[i++]);
 
 	// init unused commands
 	while (i < MAX_COMMANDS)
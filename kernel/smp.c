@@ -0,0 +1,434 @@
+
+#include <kernel.h>
+
+/*
+ * Multiprocessor support, compiled in with -DSMP.
+ *
+ * init_smp() starts the application processors (APs) through the
+ * local APIC with the usual INIT, STARTUP, STARTUP sequence. Every AP
+ * gets an idle process of its own, which halts until an IPI arrives.
+ * The bootstrap processor (BSP) keeps getting all device interrupts
+ * and sends IPI_RESCHED_INTR to the APs on every timer tick, which
+ * time slices the processes running on them.
+ *
+ * There is a single ready queue. A CPU that calls the dispatcher takes
+ * the first ready process that is not running on another CPU, so an
+ * idle CPU picks up work from the others right away. The null process
+ * only runs on the BSP.
+ *
+ * CPUs are numbered in the order they start, the BSP being 0; the
+ * APIC IDs of the hardware need not be dense and are only used to
+ * send IPIs. Every CPU keeps the selector of a segment based at its
+ * entry of cpus[] in %gs, which makes cpu_id() and active_proc a
+ * single load (see kernel.h).
+ *
+ * The critical sections of the kernel (DISABLE_INTR/ENABLE_INTR) also
+ * take the kernel lock, a spin lock that can be taken again by the
+ * CPU that holds it. A process that is switched out within a critical
+ * section keeps its nesting depth in its PCB, like it keeps its
+ * interrupt flag in the saved EFLAGS.
+ */
+
+CPU cpus[MAX_CPUS];
+
+/* number of CPUs running processes */
+int smp_cpus = 1;
+
+/*
+ * TRUE if isr_common has to release the kernel lock after switching
+ * to the stack of the next process.
+ */
+#ifdef SMP
+BOOL smp_enabled = TRUE;
+#else
+BOOL smp_enabled = FALSE;
+#endif
+
+// called by isr_common on the stack of the new process
+void switch_done()
+{
+	unlock_kernel();
+}
+
+
+#ifdef SMP
+
+#define LAPIC_ID		(0x020 / 4)
+#define LAPIC_EOI		(0x0B0 / 4)
+#define LAPIC_SVR		(0x0F0 / 4)
+#define LAPIC_ICR_LOW		(0x300 / 4)
+#define LAPIC_ICR_HIGH		(0x310 / 4)
+
+#define LAPIC_ENABLE		0x100
+#define LAPIC_SPURIOUS_INTR	0xFF
+
+#define ICR_INIT		0x00000500
+#define ICR_STARTUP		0x00000600
+#define ICR_PENDING		0x00001000
+#define ICR_ASSERT		0x00004000
+#define ICR_ALL_BUT_SELF	0x000C0000
+
+/* NULL until init_smp() found the local APIC */
+volatile unsigned *lapic = NULL;
+
+volatile unsigned kernel_lock;
+volatile int kernel_lock_owner = -1;
+int kernel_lock_depth;
+
+/* filled in by init_smp(), taken by the APs in the order they start */
+MEM_ADDR ap_stacks[MAX_CPUS - 1];
+PROCESS ap_idle[MAX_CPUS - 1];
+volatile int ap_started;
+
+
+/* segment of cpus[n], after the flat segments of the boot loader */
+#define CPU_SELECTOR(n)		(0x20 + 8 * (n))
+
+GDT cpu_gdt[4 + MAX_CPUS];
+
+
+void load_cpu_segment(int n)
+{
+	asm volatile ("movw %w0, %%gs" : : "r" (CPU_SELECTOR(n)));
+}
+
+
+/*
+ * init_cpu_segments
+ *----------------------------------------------------------------------------
+ * Installs a GDT with the flat segments of the boot loader and one
+ * segment per entry of cpus[], and selects the segment of the BSP.
+ * Must be called before the first critical section.
+ */
+void init_cpu_segments()
+{
+	volatile unsigned char mem48[6];
+	int i;
+
+	k_memset(cpu_gdt, 0, sizeof(cpu_gdt));
+	init_gdt_entry(cpu_gdt, CODE_SELECTOR, 0, 0xfffff, 0x9a, 0xc);
+	init_gdt_entry(cpu_gdt, DATA_SELECTOR, 0, 0xfffff, 0x92, 0xc);
+	init_gdt_entry(cpu_gdt, 0x18, 0, 0xfffff, 0x92, 0xc);
+	for (i = 0; i < MAX_CPUS; i++)
+	{
+		cpus[i].id = i;
+		init_gdt_entry(cpu_gdt, CPU_SELECTOR(i), (unsigned) &cpus[i],
+			       sizeof(CPU) - 1, 0x92, 0x4);
+	}
+
+	*((unsigned short *) &mem48[0]) = sizeof(cpu_gdt) - 1;
+	*((unsigned *) &mem48[2]) = (unsigned) cpu_gdt;
+	asm ("lgdt %0" : "=m" (mem48));
+	load_cpu_segment(0);
+
+	assert((char*) &cpus[0].current - (char*) cpus == CPU_CURRENT_OFFSET);
+	assert((char*) &cpus[0].id - (char*) cpus == CPU_ID_OFFSET);
+}
+
+
+/*
+ * lock_kernel
+ *----------------------------------------------------------------------------
+ * Takes the kernel lock, or nests once more if this CPU holds it.
+ * Called with interrupts disabled.
+ */
+void lock_kernel()
+{
+	int cpu = cpu_id();
+	unsigned busy;
+
+	if (kernel_lock_owner == cpu)
+	{
+		kernel_lock_depth++;
+		return;
+	}
+	while (1)
+	{
+		busy = 1;
+		asm volatile ("xchgl %0, %1" : "+r" (busy), "+m" (kernel_lock) : : "memory");
+		if (busy == 0)
+		{
+			break;
+		}
+		while (kernel_lock)
+		{
+			asm volatile ("rep; nop");	/* pause */
+		}
+	}
+	kernel_lock_owner = cpu;
+	kernel_lock_depth = 1;
+}
+
+
+void unlock_kernel()
+{
+	assert(kernel_lock_owner == cpu_id());
+
+	if (--kernel_lock_depth == 0)
+	{
+		kernel_lock_owner = -1;
+		asm volatile ("" : : : "memory");
+		kernel_lock = 0;
+	}
+}
+
+
+/*
+ * switch_cpu
+ *----------------------------------------------------------------------------
+ * Called by service_intr() with the kernel lock held when the calling
+ * CPU switches from process from to process to. The lock is handed
+ * over to to at its own nesting depth; isr_common releases the level
+ * taken by service_intr() once it runs on the stack of to, so no other
+ * CPU can resume from while its stack is still in use.
+ */
+void switch_cpu(PROCESS from, PROCESS to)
+{
+	int cpu = cpu_id();
+
+	from->lock_depth = kernel_lock_depth - 1;
+	from->cpu = -1;
+	to->cpu = cpu;
+	kernel_lock_depth = to->lock_depth + 1;
+	cpus[cpu].current = to;
+}
+
+
+void send_ipi(unsigned dest, unsigned icr)
+{
+	while (lapic[LAPIC_ICR_LOW] & ICR_PENDING);
+	lapic[LAPIC_ICR_HIGH] = dest << 24;
+	lapic[LAPIC_ICR_LOW] = icr;
+}
+
+
+/*
+ * smp_tick
+ *----------------------------------------------------------------------------
+ * Timer tick on the BSP. The timer handler charged the tick to the
+ * process running on the BSP; the processes running on the APs are
+ * charged here. Then the APs time slice.
+ */
+void smp_tick()
+{
+	int i;
+
+	if (smp_cpus > 1)
+	{
+		for (i = 0; i < MAX_CPUS; i++)
+		{
+			if (i != cpu_id() && cpus[i].online && cpus[i].current != NULL)
+			{
+				cpus[i].current->stats.cpu_ticks++;
+			}
+		}
+		send_ipi(0, ICR_ALL_BUT_SELF | ICR_ASSERT | IPI_RESCHED_INTR);
+	}
+}
+
+
+// a process became ready: wake up an idle AP to run it
+void smp_kick_idle()
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++)
+	{
+		if (cpus[i].online && cpus[i].idle != NULL
+		    && cpus[i].current == cpus[i].idle && i != cpu_id())
+		{
+			send_ipi(cpus[i].apic_id, ICR_ASSERT | IPI_RESCHED_INTR);
+			return;
+		}
+	}
+}
+
+
+void resched_intr_handler(int intr_no)
+{
+	lapic[LAPIC_EOI] = 0;
+}
+
+
+void enable_lapic()
+{
+	lapic[LAPIC_SVR] = LAPIC_ENABLE | LAPIC_SPURIOUS_INTR;
+}
+
+
+// busy waits, the PIT must be running
+void delay_us(unsigned us)
+{
+	unsigned start = get_time_us();
+
+	while (get_time_us() - start < us);
+}
+
+
+/*
+ * Real mode start-up code of the APs. It is copied to
+ * AP_TRAMPOLINE_BASE, loads the GDT of the BSP into ap_gdt_ptr,
+ * switches to protected mode and calls ap_main() on a stack from
+ * ap_stacks[].
+ */
+extern char ap_trampoline[], ap_trampoline_end[], ap_gdt_ptr[];
+
+/* turns a define into a string for the assembly code */
+#define STR(x)		#x
+#define XSTR(x)		STR(x)
+
+asm (
+	".text\n"
+	".code16\n"
+	".globl ap_trampoline\n"
+"ap_trampoline:\n"
+	"cli\n"
+	"movw %cs, %ax\n"
+	"movw %ax, %ds\n"
+	"lgdtl ap_gdt_ptr - ap_trampoline\n"
+	"movl %cr0, %eax\n"
+	"orl $1, %eax\n"
+	"movl %eax, %cr0\n"
+	"ljmpl $" XSTR(CODE_SELECTOR) ", $(ap_protected - ap_trampoline + "
+		XSTR(AP_TRAMPOLINE_BASE) ")\n"
+	".align 4\n"
+	".globl ap_gdt_ptr\n"
+"ap_gdt_ptr:\n"
+	".word 0\n"
+	".long 0\n"
+	".code32\n"
+"ap_protected:\n"
+	"movw $" XSTR(DATA_SELECTOR) ", %ax\n"
+	"movw %ax, %ds\n"
+	"movw %ax, %es\n"
+	"movw %ax, %fs\n"
+	"movw %ax, %gs\n"
+	"movw %ax, %ss\n"
+	"movl $1, %eax\n"
+	"lock xaddl %eax, ap_started\n"
+	"cmpl $" XSTR(MAX_CPUS) " - 1, %eax\n"
+	"jae 1f\n"
+	"movl ap_stacks(,%eax,4), %esp\n"
+	"testl %esp, %esp\n"
+	"jz 1f\n"
+	"pushl %eax\n"
+	"movl $ap_main, %ecx\n"
+	"call *%ecx\n"
+"1:\n"
+	"cli\n"
+	"hlt\n"
+	"jmp 1b\n"
+	".globl ap_trampoline_end\n"
+"ap_trampoline_end:\n"
+);
+
+
+/*
+ * ap_main
+ *----------------------------------------------------------------------------
+ * Entry point of the n-th AP that started, which becomes CPU n + 1.
+ * It runs as the idle process of the AP, which init_smp() created for
+ * it.
+ */
+void ap_main(int n)
+{
+	PROCESS idle = ap_idle[n];
+	int cpu = n + 1;
+
+	load_cpu_segment(cpu);
+	load_idt(idt);
+	enable_lapic();
+
+	lock_kernel();
+	cpus[cpu].apic_id = lapic[LAPIC_ID] >> 24;
+	idle->cpu = cpu;
+	cpus[cpu].idle = idle;
+	cpus[cpu].current = idle;
+	cpus[cpu].online = TRUE;
+	smp_cpus++;
+	unlock_kernel();
+
+	while (1)
+	{
+		asm ("sti; hlt");
+	}
+}
+
+
+BOOL has_lapic()
+{
+	unsigned a, b, c, d;
+
+	asm ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+	return (d & (1 << 9)) != 0;
+}
+
+
+/*
+ * init_smp
+ *----------------------------------------------------------------------------
+ * Starts the APs. Must be called by the boot process, with interrupts
+ * and the PIT running.
+ */
+void init_smp()
+{
+	unsigned lo, hi;
+	int i, n;
+
+	if (!has_lapic())
+	{
+		return;
+	}
+
+	asm volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (0x1B));
+	lapic = (unsigned *) (lo & 0xFFFFF000);
+	enable_lapic();
+
+	cpus[0].apic_id = lapic[LAPIC_ID] >> 24;
+	cpus[0].idle = NULL;
+	cpus[0].online = TRUE;
+	active_proc->cpu = 0;
+	register_interrupt_handler(IPI_RESCHED_INTR, resched_intr_handler);
+
+	for (i = 0; i < MAX_CPUS - 1; i++)
+	{
+		ap_idle[i] = alloc_process(0, "AP idle", SMALL_STACK_SIZE);
+		ap_stacks[i] = ap_idle[i]->stack_base + ap_idle[i]->stack_size;
+	}
+	ap_started = 0;
+
+	k_memcpy((void*) AP_TRAMPOLINE_BASE, ap_trampoline,
+		 ap_trampoline_end - ap_trampoline);
+	asm ("sgdt %0" : "=m" (*(char*) (AP_TRAMPOLINE_BASE + (ap_gdt_ptr - ap_trampoline))));
+
+	send_ipi(0, ICR_ALL_BUT_SELF | ICR_ASSERT | ICR_INIT);
+	delay_us(10000);
+	for (i = 0; i < 2; i++)
+	{
+		send_ipi(0, ICR_ALL_BUT_SELF | ICR_ASSERT | ICR_STARTUP
+			 | (AP_TRAMPOLINE_BASE >> 12));
+		delay_us(200);
+	}
+
+	/* give the APs time to come up */
+	do
+	{
+		n = ap_started;
+		delay_us(10000);
+	} while (n != ap_started);
+
+	/* return what the missing APs did not take */
+	for (i = min(n, MAX_CPUS - 1); i < MAX_CPUS - 1; i++)
+	{
+		ap_stacks[i] = (MEM_ADDR) NULL;
+		kill_process(ap_idle[i], TRUE);
+	}
+
+	if (n > 0)
+	{
+		/* the APs need the periodic tick */
+		tickless_idle = FALSE;
+	}
+}
+
+#endif
@@ -0,0 +1,443 @@
+
+#include <kernel.h>
+
+/*
+ * Buddy allocator for process stacks. The pool covers the memory
+ * from STACK_POOL_BASE (1 MB) to STACK_POOL_BASE + STACK_POOL_SIZE.
+ * Blocks are powers of two between 2^MIN_STACK_ORDER and
+ * 2^MAX_STACK_ORDER bytes. A free block keeps its free list links in
+ * its first bytes, so the bookkeeping outside the pool is a few bytes
+ * per minimal block.
+ *
+ * Every stack is filled with STACK_CANARY when it is handed out, so
+ * stack_high_water() can tell how deep a process has ever gone. Most
+ * of that filling is done ahead of time by clean_stacks_job(), which
+ * the null process runs on free memory. When
+ * compiled with STACK_GUARD_PAGES, paging is turned on and the lowest
+ * page of every block is left unmapped, so running off the end of a
+ * stack faults instead of overwriting the next one.
+ */
+
+#define MIN_STACK_ORDER		12
+#define MAX_STACK_ORDER		22
+#define STACK_POOL_SIZE		(1 << MAX_STACK_ORDER)
+#define NUM_STACK_BLOCKS	(STACK_POOL_SIZE >> MIN_STACK_ORDER)
+
+#define BLOCK_FREE		0x80
+#define BLOCK_ORDER_MASK	0x7f
+
+#define BLOCK_INDEX(addr)	(((addr) - STACK_POOL_BASE) >> MIN_STACK_ORDER)
+
+
+struct _free_block;
+
+typedef struct _free_block
+{
+	struct _free_block *next;
+	struct _free_block *prev;
+} free_block;
+
+free_block *free_blocks[MAX_STACK_ORDER + 1];
+
+/*
+ * For the first minimal block of every allocated or free block:
+ * its order, plus BLOCK_FREE if it is on a free list.
+ */
+unsigned char block_order[NUM_STACK_BLOCKS];
+
+/*
+ * TRUE for the minimal blocks that are free and already filled with
+ * STACK_CANARY.
+ */
+BOOL block_clean[NUM_STACK_BLOCKS];
+
+/*
+ * The minimal blocks that are free but not clean, linked by index
+ * (-1 ends the list), so clean_stacks_job() takes the next one
+ * without a search.
+ */
+short dirty_next[NUM_STACK_BLOCKS];
+short dirty_prev[NUM_STACK_BLOCKS];
+int dirty_head;
+
+
+#ifdef STACK_GUARD_PAGES
+
+#define PAGE_SIZE		4096
+#define PAGE_PRESENT		0x01
+#define PAGE_WRITE		0x02
+
+/* identity map the first 8 MB, which covers the stack pool */
+#define PAGED_MEMORY		(8*1024*1024)
+#define NUM_PAGE_TABLES		(PAGED_MEMORY / (1024 * PAGE_SIZE))
+
+unsigned page_directory[1024] __attribute__ ((aligned (PAGE_SIZE)));
+unsigned page_table[NUM_PAGE_TABLES][1024] __attribute__ ((aligned (PAGE_SIZE)));
+
+#define STACK_GUARD_SIZE	PAGE_SIZE
+
+
+void set_page_present(MEM_ADDR addr, BOOL present)
+{
+	unsigned *pte = &page_table[0][0] + (addr / PAGE_SIZE);
+
+	if (present)
+	{
+		*pte |= PAGE_PRESENT;
+	}
+	else
+	{
+		*pte &= ~PAGE_PRESENT;
+	}
+
+	/* flush the TLB */
+	asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+}
+
+
+void init_paging()
+{
+	int i;
+	unsigned *pte = &page_table[0][0];
+
+	for (i = 0; i < NUM_PAGE_TABLES * 1024; i++)
+	{
+		pte[i] = i * PAGE_SIZE | PAGE_WRITE | PAGE_PRESENT;
+	}
+	for (i = 0; i < 1024; i++)
+	{
+		page_directory[i] = 0;
+	}
+	for (i = 0; i < NUM_PAGE_TABLES; i++)
+	{
+		page_directory[i] = (unsigned)page_table[i] | PAGE_WRITE | PAGE_PRESENT;
+	}
+
+	asm volatile ("movl %0, %%cr3;"
+		"movl %%cr0, %%eax;"
+		"orl $0x80000000, %%eax;"
+		"movl %%eax, %%cr0"
+		:
+		: "r" (page_directory)
+		: "eax", "memory"
+		);
+}
+
+#else
+
+#define STACK_GUARD_SIZE	0
+
+#endif
+
+
+void add_free_block(MEM_ADDR addr, int order)
+{
+	free_block *b = (free_block *)addr;
+
+	b->prev = NULL;
+	b->next = free_blocks[order];
+	if (b->next != NULL)
+	{
+		b->next->prev = b;
+	}
+	free_blocks[order] = b;
+	block_order[BLOCK_INDEX(addr)] = order | BLOCK_FREE;
+}
+
+void add_dirty_block(int i)
+{
+	dirty_prev[i] = -1;
+	dirty_next[i] = dirty_head;
+	if (dirty_head >= 0)
+	{
+		dirty_prev[dirty_head] = i;
+	}
+	dirty_head = i;
+}
+
+void remove_dirty_block(int i)
+{
+	if (dirty_prev[i] >= 0)
+	{
+		dirty_next[dirty_prev[i]] = dirty_next[i];
+	}
+	else
+	{
+		dirty_head = dirty_next[i];
+	}
+	if (dirty_next[i] >= 0)
+	{
+		dirty_prev[dirty_next[i]] = dirty_prev[i];
+	}
+}
+
+void remove_free_block(MEM_ADDR addr, int order)
+{
+	free_block *b = (free_block *)addr;
+
+	if (b->prev != NULL)
+	{
+		b->prev->next = b->next;
+	}
+	else
+	{
+		free_blocks[order] = b->next;
+	}
+	if (b->next != NULL)
+	{
+		b->next->prev = b->prev;
+	}
+	block_order[BLOCK_INDEX(addr)] = order;
+}
+
+
+/*
+ * alloc_stack
+ *----------------------------------------------------------------------------
+ * Returns the lowest usable address of a stack of at least size bytes,
+ * or NULL if the pool is exhausted. The real size of the stack is
+ * returned by stack_block_size(). The stack is filled with
+ * STACK_CANARY.
+ */
+
+MEM_ADDR alloc_stack(int size)
+{
+	int order, o, b;
+	MEM_ADDR addr, start;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	size += STACK_GUARD_SIZE;
+	for (order = MIN_STACK_ORDER; order < MAX_STACK_ORDER && (1 << order) < size; order++);
+	assert((1 << order) >= size);
+
+	/* smallest free block that is large enough */
+	for (o = order; o <= MAX_STACK_ORDER && free_blocks[o] == NULL; o++);
+	if (o > MAX_STACK_ORDER)
+	{
+		ENABLE_INTR(saved_if);
+		return (MEM_ADDR)NULL;
+	}
+
+	addr = (MEM_ADDR)free_blocks[o];
+	remove_free_block(addr, o);
+
+	/* split it, returning the upper halves to the free lists */
+	while (o > order)
+	{
+		o--;
+		add_free_block(addr + (1 << o), o);
+	}
+	block_order[BLOCK_INDEX(addr)] = order;
+
+	/* keep clean_stacks_job() off the block */
+	for (b = 0; b < (1 << (order - MIN_STACK_ORDER)); b++)
+	{
+		if (!block_clean[BLOCK_INDEX(addr) + b])
+		{
+			remove_dirty_block(BLOCK_INDEX(addr) + b);
+		}
+	}
+
+#ifdef STACK_GUARD_PAGES
+	set_page_present(addr, FALSE);
+#endif
+
+	ENABLE_INTR(saved_if);
+
+	/*
+	 * Only fill what clean_stacks_job() did not get to. A clean
+	 * block may still hold free list links in its first bytes.
+	 */
+	for (b = 0; b < (1 << (order - MIN_STACK_ORDER)); b++)
+	{
+		start = addr + (b << MIN_STACK_ORDER);
+		if (b >= (STACK_GUARD_SIZE >> MIN_STACK_ORDER))
+		{
+			fill_stack_canary(start, start + (block_clean[BLOCK_INDEX(start)]
+				? sizeof(free_block) : (1 << MIN_STACK_ORDER)));
+		}
+		block_clean[BLOCK_INDEX(start)] = FALSE;
+	}
+
+	return addr + STACK_GUARD_SIZE;
+}
+
+
+/*
+ * free_stack
+ *----------------------------------------------------------------------------
+ * Returns a block obtained from alloc_stack() to the pool and merges
+ * it with its buddies. Addresses outside of the pool (e.g. the stack
+ * of the boot process) are ignored.
+ */
+
+void free_stack(MEM_ADDR addr)
+{
+	int order, b;
+	MEM_ADDR buddy;
+
+	volatile int saved_if;
+
+	if (addr < STACK_POOL_BASE || addr >= STACK_POOL_BASE + STACK_POOL_SIZE)
+	{
+		return;
+	}
+
+	DISABLE_INTR(saved_if);
+
+	addr -= STACK_GUARD_SIZE;
+#ifdef STACK_GUARD_PAGES
+	set_page_present(addr, TRUE);
+#endif
+
+	order = block_order[BLOCK_INDEX(addr)];
+	assert((order & BLOCK_FREE) == 0);
+
+	/* the process used it, so none of it is clean */
+	for (b = (1 << (order - MIN_STACK_ORDER)) - 1; b >= 0; b--)
+	{
+		add_dirty_block(BLOCK_INDEX(addr) + b);
+	}
+
+	while (order < MAX_STACK_ORDER)
+	{
+		buddy = STACK_POOL_BASE + ((addr - STACK_POOL_BASE) ^ (1 << order));
+		if (block_order[BLOCK_INDEX(buddy)] != (order | BLOCK_FREE))
+		{
+			break;
+		}
+		remove_free_block(buddy, order);
+		addr = min(addr, buddy);
+		order++;
+	}
+	add_free_block(addr, order);
+
+	ENABLE_INTR(saved_if);
+
+	kick_idle_job(clean_stacks_job);
+}
+
+
+/*
+ * clean_stacks_job
+ *----------------------------------------------------------------------------
+ * Idle job: fills the first free minimal block that is not clean yet
+ * with STACK_CANARY, so alloc_stack() does not have to. Returns FALSE
+ * when all free memory is clean.
+ */
+
+BOOL clean_stacks_job(void* data)
+{
+	int b;
+	MEM_ADDR addr;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	b = dirty_head;
+	if (b < 0)
+	{
+		ENABLE_INTR(saved_if);
+		return FALSE;
+	}
+	remove_dirty_block(b);
+
+	/*
+	 * The first bytes may hold free list links, alloc_stack()
+	 * fills them for a clean block.
+	 */
+	addr = STACK_POOL_BASE + (b << MIN_STACK_ORDER);
+	fill_stack_canary(addr + sizeof(free_block), addr + (1 << MIN_STACK_ORDER));
+	block_clean[b] = TRUE;
+
+	ENABLE_INTR(saved_if);
+	return TRUE;
+}
+
+
+/*
+ * stack_block_size
+ *----------------------------------------------------------------------------
+ * Usable size in bytes of a stack returned by alloc_stack().
+ */
+
+int stack_block_size(MEM_ADDR addr)
+{
+	addr -= STACK_GUARD_SIZE;
+	return (1 << (block_order[BLOCK_INDEX(addr)] & BLOCK_ORDER_MASK)) - STACK_GUARD_SIZE;
+}
+
+
+void fill_stack_canary(MEM_ADDR bottom, MEM_ADDR top)
+{
+	LONG *p = (LONG *)bottom;
+	LONG *end = (LONG *)top;
+
+	while (p < end)
+	{
+		*p++ = STACK_CANARY;
+	}
+}
+
+
+/*
+ * stack_high_water
+ *----------------------------------------------------------------------------
+ * Number of bytes of the stack [bottom, bottom + size) that have ever
+ * been written, found by scanning for the first overwritten canary.
+ */
+
+int stack_high_water(MEM_ADDR bottom, int size)
+{
+	LONG *p = (LONG *)bottom;
+	LONG *end = (LONG *)(bottom + size);
+
+	while (p < end && *p == STACK_CANARY)
+	{
+		p++;
+	}
+	return (MEM_ADDR)end - (MEM_ADDR)p;
+}
+
+
+/*
+ * The pool lives above 1 MB, so make sure that address line 20
+ * is not masked (fast A20 gate of the system control port A).
+ */
+void enable_a20()
+{
+	unsigned char a = inportb(0x92);
+
+	if ((a & 0x02) == 0)
+	{
+		outportb(0x92, (a | 0x02) & ~0x01);
+	}
+}
+
+
+void init_stacks()
+{
+	int i;
+
+	enable_a20();
+
+#ifdef STACK_GUARD_PAGES
+	init_paging();
+#endif
+
+	for (i = 0; i <= MAX_STACK_ORDER; i++)
+	{
+		free_blocks[i] = NULL;
+	}
+	dirty_head = -1;
+	for (i = NUM_STACK_BLOCKS - 1; i >= 0; i--)
+	{
+		block_order[i] = 0;
+		block_clean[i] = FALSE;
+		add_dirty_block(i);
+	}
+
+	add_free_block(STACK_POOL_BASE, MAX_STACK_ORDER);
+}
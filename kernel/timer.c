@@ -1,19 +1,93 @@
 
 #include <kernel.h>
 
+/*
+ * Timers are kept in a hashed timer wheel. A timer expiring at tick
+ * t is linked into slot t % TIMER_WHEEL_SIZE, so arming and cancelling
+ * a timer is O(1). On every timer interrupt the slot of the current
+ * tick is scanned; timers that are due are moved to the expired list,
+ * timers of a later round stay in the slot. The timer notifier is only
+ * woken up if the expired list is not empty, so ticks without expiring
+ * timers cost no IPC at all. All timers that expired since the last
+ * run are handled by the timer process in one batch.
+ *
+ * The wheel and the expired list are shared with the timer interrupt,
+ * so they may only be touched with interrupts disabled.
+ */
+
+/*
+ * Tickless idle: while the null process is the only runnable process,
+ * PIT channel 0 is switched from its periodic mode to a one-shot that
+ * fires at the next timer deadline, so an idle CPU can halt through
+ * several ticks. The skipped ticks are added to _TOS_time when the
+ * one-shot fires, or from the counter if another interrupt ends the
+ * idle period first. A one-shot can cover at most 0xFFFF PIT input
+ * clocks, so at the BIOS default rate of ~18.2 Hz it never covers
+ * more than one tick and only the halting remains.
+ */
+
+#define PIT_FREQUENCY		1193182	/* input clock in Hz */
+#define PIT_CHANNEL_0		0x40
+#define PIT_COMMAND		0x43
+#define PIT_LATCH_0		0x00	/* latch the count of channel 0 */
+#define PIT_ONE_SHOT_0		0x30	/* channel 0, lo/hi byte, mode 0 */
+#define PIT_PERIODIC_0		0x34	/* channel 0, lo/hi byte, mode 2 */
+#define PIT_STATUS_0		0xE2	/* read-back status of channel 0 */
+#define PIT_STATUS_OUT		0x80	/* output pin: the one-shot fired */
+#define PIT_MAX_COUNT		0x10000
+
+/* microseconds per PIT input clock in 16.16 fixed point */
+#define PIT_CLOCK_US_16		54925
+
+#define PIC_MASTER		0x20
+#define PIC_READ_IRR		0x0A
+
+#define TIMER_WHEEL_SIZE	64	/* must be a power of 2 */
+#define MAX_TIMERS		(2 * MAX_PROCS)
+
+#define TIMER_FREE		0
+#define TIMER_ARMED		1	/* in a slot of the wheel */
+#define TIMER_EXPIRED		2	/* on the expired list */
+#define TIMER_FIRED		3	/* handled, waiting for cancel_timeout() */
+
+#define TIMER_SLEEP		0	/* sleep(): reply to proc */
+#define TIMER_TIMEOUT		1	/* receive_timeout(): wake proc up */
+#define TIMER_PERIODIC		2	/* periodic_timer(): re-armed */
+
 struct _Timer;
 
 typedef struct _Timer
 {
-    int num_of_ticks;
+    unsigned int expires;	/* value of _TOS_time when the timer is due */
+    int state;
+    int type;
+    PROCESS proc;
+    int period;			/* TIMER_PERIODIC only */
+    int expirations;		/* since the last wait_periodic() */
+    BOOL waiting;		/* proc is blocked in wait_periodic() */
     struct _Timer *next;
+    struct _Timer *prev;
 } Timer;
-Timer tml[MAX_PROCS];
 
-Timer *tml_head;
+Timer timer_pool[MAX_TIMERS];
+Timer *free_timers;
+
+Timer *timer_wheel[TIMER_WHEEL_SIZE];
+Timer *expired_timers;
 
 PORT timer_port;
 
+BOOL tickless_idle = TRUE;
+
+unsigned pit_divisor = PIT_MAX_COUNT;	/* PIT input clocks per tick */
+unsigned timer_hz = (PIT_FREQUENCY + PIT_MAX_COUNT / 2) / PIT_MAX_COUNT;
+unsigned one_shot_ticks;		/* ticks of the one-shot, or 0 */
+
+/* get_time_us() at the last change of the rate, and _TOS_time then */
+unsigned time_base_us;
+unsigned time_base_ticks;
+unsigned one_shot_count;		/* PIT input clocks of the one-shot */
+
 
 void sleep(int ticks)
 {
@@ -22,6 +96,20 @@ void sleep(int ticks)
 	send(timer_port, (void *)&msg);
 }
 
+/*
+ * sleep_until
+ *----------------------------------------------------------------------------
+ * Sleeps until _TOS_time reaches tick. Loops that compute their next
+ * deadline from the previous one do not drift. A tick that already
+ * passed wakes up with the next tick.
+ */
+void sleep_until(unsigned int tick)
+{
+	Timer_Message msg;
+	msg.until = tick;
+	send_buf(timer_port, (void *)&msg, sizeof(msg));
+}
+
 void timer_notifier(PROCESS self, PARAM param)
 {
 	while(1)
@@ -31,99 +119,538 @@ void timer_notifier(PROCESS self, PARAM param)
 	}
 }
 
-// adds a timer to the timer differential list
-// don't worry about interrupts, data-structure not shared
-void add_timer_list(int num_of_ticks, PROCESS proc)
+
+void link_timer(Timer **list, Timer *t)
 {
-	Timer *t;
-	
-	// kprintf("adding %d to timer list with %d ticks", proc-pcb, num_of_ticks);
+	t->prev = NULL;
+	t->next = *list;
+	if (t->next != NULL)
+	{
+		t->next->prev = t;
+	}
+	*list = t;
+}
 
-	// head null, insert as head
-	if (tml_head == NULL)
+void unlink_timer(Timer **list, Timer *t)
+{
+	if (t->prev != NULL)
 	{
-		tml_head = &tml[proc - pcb];
-		tml_head->num_of_ticks = num_of_ticks;
-		tml_head->next = NULL;
-		return;
+		t->prev->next = t->next;
+	}
+	else
+	{
+		*list = t->next;
 	}
+	if (t->next != NULL)
+	{
+		t->next->prev = t->prev;
+	}
+	t->next = t->prev = NULL;
+}
+
+
+// arms a timer for proc that expires after ticks ticks
+// the caller must disable interrupts
+Timer *arm_timer(PROCESS proc, int ticks, int type)
+{
+	Timer *t = free_timers;
 
-	// insert at head of list
-	if (num_of_ticks < tml_head->num_of_ticks)
+	assert(t != NULL);
+	free_timers = t->next;
+
+	if (ticks < 1)
+		ticks = 1;
+	t->expires = _TOS_time + ticks;
+	t->state = TIMER_ARMED;
+	t->type = type;
+	t->proc = proc;
+	t->period = 0;
+	t->expirations = 0;
+	t->waiting = FALSE;
+	link_timer(&timer_wheel[t->expires & (TIMER_WHEEL_SIZE - 1)], t);
+	return t;
+}
+
+// removes t from the wheel or the expired list and frees it
+// the caller must disable interrupts
+void free_timer(Timer *t)
+{
+	if (t->state == TIMER_ARMED)
+	{
+		unlink_timer(&timer_wheel[t->expires & (TIMER_WHEEL_SIZE - 1)], t);
+	}
+	else if (t->state == TIMER_EXPIRED)
 	{
-		// decrease head by num_of_ticks
-		tml_head->num_of_ticks -= num_of_ticks;
+		unlink_timer(&expired_timers, t);
+	}
+	t->state = TIMER_FREE;
+	t->proc = NULL;
+	t->next = free_timers;
+	free_timers = t;
+}
 
-		tml[proc - pcb].num_of_ticks = num_of_ticks;
+// moves the timers due at tick now to the expired list
+// periodic timers are re-armed and wake up their owner right here
+void expire_timers(unsigned int now)
+{
+	Timer *t = timer_wheel[now & (TIMER_WHEEL_SIZE - 1)];
+	Timer *next;
 
-		// insert before head
-		tml[proc - pcb].next = tml_head;
-		tml_head = &tml[proc - pcb];
-		return;
+	while (t != NULL)
+	{
+		next = t->next;
+		if (t->expires == now)
+		{
+			TRACE(TRACE_TIMER, t->proc - pcb, t->type);
+			unlink_timer(&timer_wheel[now & (TIMER_WHEEL_SIZE - 1)], t);
+			if (t->type == TIMER_PERIODIC)
+			{
+				t->expires += t->period;
+				link_timer(&timer_wheel[t->expires & (TIMER_WHEEL_SIZE - 1)], t);
+				t->expirations++;
+				if (t->waiting)
+				{
+					t->waiting = FALSE;
+					add_ready_queue(t->proc);
+				}
+			}
+			else
+			{
+				t->state = TIMER_EXPIRED;
+				link_timer(&expired_timers, t);
+			}
+		}
+		t = next;
 	}
+}
 
-	// insert after head
-	t = tml_head;
-	while(1)
+// frees all timers of proc, which is being killed
+void release_timers(PROCESS proc)
+{
+	Timer *t;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	for (t = timer_pool; t < timer_pool + MAX_TIMERS; t++)
 	{
-		if (num_of_ticks >= t->num_of_ticks)
+		if (t->state != TIMER_FREE && t->proc == proc)
 		{
-			num_of_ticks -= t->num_of_ticks;
+			free_timer(t);
 		}
-		else
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+
+// advances _TOS_time by ticks ticks, expiring the timers on the way
+void advance_timers(unsigned ticks)
+{
+	active_proc->stats.cpu_ticks += ticks;
+	while (ticks-- > 0)
+	{
+		_TOS_time++;
+		expire_timers(_TOS_time);
+	}
+
+	// a notifier that is busy picks the expired timers up
+	// with the next tick
+	if (expired_timers != NULL)
+	{
+		wake_intr_process(TIMER_IRQ);
+	}
+}
+
+// number of ticks until the next timer is due, at most max_ticks
+unsigned next_timer_ticks(unsigned max_ticks)
+{
+	Timer *t;
+	unsigned k;
+
+	for (k = 1; k < max_ticks; k++)
+	{
+		t = timer_wheel[(_TOS_time + k) & (TIMER_WHEEL_SIZE - 1)];
+		for (; t != NULL; t = t->next)
 		{
-			break;
+			if (t->expires == _TOS_time + k)
+				return k;
 		}
+	}
+	return max_ticks;
+}
 
-		if (t->next == NULL) break;
 
-		t = t->next;
+void pit_write_count(unsigned char command, unsigned count)
+{
+	outportb(PIT_COMMAND, command);
+	outportb(PIT_CHANNEL_0, count & 0xFF);
+	outportb(PIT_CHANNEL_0, (count >> 8) & 0xFF);
+}
+
+unsigned pit_read_count()
+{
+	unsigned count;
+
+	outportb(PIT_COMMAND, PIT_LATCH_0);
+	count = inportb(PIT_CHANNEL_0);
+	count |= inportb(PIT_CHANNEL_0) << 8;
+	return (count == 0) ? PIT_MAX_COUNT : count;
+}
+
+
+/*
+ * Timer interrupt while the timer service runs
+ */
+void timer_wheel_intr_handler(int intr_no)
+{
+	unsigned ticks = 1;
+
+	if (one_shot_ticks != 0)
+	{
+		// end of a tickless idle period
+		ticks = one_shot_ticks;
+		one_shot_ticks = 0;
+		pit_write_count(PIT_PERIODIC_0, pit_divisor);
 	}
+	advance_timers(ticks);
+}
 
-	// decrease next by num_of_ticks
-	if (t->next != NULL)
+
+/*
+ * enter_tickless_idle
+ *----------------------------------------------------------------------------
+ * Called by the null process with interrupts disabled right before it
+ * halts. Replaces the periodic tick by a one-shot for the next timer
+ * deadline.
+ */
+void enter_tickless_idle()
+{
+	unsigned remaining;
+	unsigned max_ticks;
+	unsigned ticks;
+
+	if (!tickless_idle || one_shot_ticks != 0 || expired_timers != NULL ||
+	    intr_handler[TIMER_IRQ] != timer_wheel_intr_handler)
+		return;
+
+	// PIT input clocks until the next periodic tick
+	remaining = pit_read_count();
+	max_ticks = 1 + (PIT_MAX_COUNT - 1 - remaining) / pit_divisor;
+	max_ticks = min(max_ticks, TIMER_WHEEL_SIZE);
+	ticks = next_timer_ticks(max_ticks);
+	if (ticks <= 1)
+		return;
+
+	one_shot_ticks = ticks;
+	one_shot_count = remaining + (ticks - 1) * pit_divisor;
+	pit_write_count(PIT_ONE_SHOT_0, one_shot_count);
+}
+
+
+/*
+ * leave_tickless_idle
+ *----------------------------------------------------------------------------
+ * Called for every IRQ but the timer's. If the idle process stopped the
+ * periodic tick, the ticks that passed are taken from the counter and
+ * the periodic tick is restarted. Less than half a tick of phase is
+ * lost.
+ */
+void leave_tickless_idle()
+{
+	unsigned elapsed;
+
+	if (one_shot_ticks == 0)
+		return;
+
+	// the one-shot fired already: the timer interrupt catches up
+	outportb(PIT_COMMAND, PIT_STATUS_0);
+	if (inportb(PIT_CHANNEL_0) & PIT_STATUS_OUT)
+		return;
+
+	elapsed = one_shot_count - pit_read_count();
+	pit_write_count(PIT_PERIODIC_0, pit_divisor);
+	one_shot_ticks = 0;
+	advance_timers((elapsed + pit_divisor / 2) / pit_divisor);
+}
+
+
+// _TOS_time and the PIT input clocks since that tick
+void read_clock(unsigned *ticks, unsigned *elapsed)
+{
+	unsigned count;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	*ticks = _TOS_time;
+	count = pit_read_count();
+	if (one_shot_ticks != 0)
+	{
+		// tickless idle: the count started at one_shot_count
+		*elapsed = (count > one_shot_count) ? one_shot_count : one_shot_count - count;
+	}
+	else
 	{
-		t->next->num_of_ticks -= num_of_ticks;
+		*elapsed = pit_divisor - min(count, pit_divisor);
+
+		// the counter reloaded, but the tick is not counted yet
+		outportb(PIC_MASTER, PIC_READ_IRR);
+		if ((inportb(PIC_MASTER) & 0x01) && *elapsed < pit_divisor / 2)
+			(*ticks)++;
 	}
 
-	tml[proc - pcb].num_of_ticks = num_of_ticks;
+	ENABLE_INTR(saved_if);
+}
 
-	// insert between t and t->next
-	tml[proc - pcb].next = t->next;
-	t->next = &tml[proc - pcb];
+// microseconds from tick time_base_ticks to elapsed clocks after tick ticks
+unsigned clock_to_us(unsigned ticks, unsigned elapsed)
+{
+	unsigned long long clocks;
+
+	clocks = (unsigned long long) (ticks - time_base_ticks) * pit_divisor + elapsed;
+	return (unsigned) ((clocks * PIT_CLOCK_US_16) >> 16);
 }
 
-// returns a PROCESS ready to wake or NULL
-PROCESS pop_timer_list()
+/*
+ * init_pit
+ *----------------------------------------------------------------------------
+ * Sets the rate of the timer tick to hz (19 - 1193182 Hz; the PIT can
+ * only divide its input clock, so the real rate is in timer_hz). Takes
+ * effect immediately if the timer service runs, else with init_timer().
+ */
+void init_pit(unsigned hz)
 {
-	PROCESS p;
-	if (tml_head != NULL)
+	unsigned ticks, elapsed;
+
+	volatile int saved_if;
+
+	assert(hz > 0);
+	DISABLE_INTR(saved_if);
+
+	// the time so far at the old rate becomes the new base
+	read_clock(&ticks, &elapsed);
+	time_base_us += clock_to_us(ticks, elapsed);
+	time_base_ticks = ticks;
+
+	pit_divisor = (PIT_FREQUENCY + hz / 2) / hz;
+	pit_divisor = max(pit_divisor, 1);
+	pit_divisor = min(pit_divisor, PIT_MAX_COUNT);
+	timer_hz = (PIT_FREQUENCY + pit_divisor / 2) / pit_divisor;
+
+	if (intr_handler[TIMER_IRQ] == timer_wheel_intr_handler)
 	{
-		if (tml_head->num_of_ticks <= 0)
-		{
-			p = pcb + (tml_head - tml);
-			tml_head = tml_head->next;
-			return p;
-		}
+		one_shot_ticks = 0;
+		pit_write_count(PIT_PERIODIC_0, pit_divisor);
 	}
-	return NULL;
+
+	ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * ms_to_ticks
+ *----------------------------------------------------------------------------
+ * Number of ticks that last at least ms milliseconds at the current
+ * rate, for sleep() and friends. Negative times give 0.
+ */
+int ms_to_ticks(int ms)
+{
+	if (ms <= 0)
+		return 0;
+	return (ms / 1000) * timer_hz + ((ms % 1000) * timer_hz + 999) / 1000;
+}
+
+
+/*
+ * get_time_us
+ *----------------------------------------------------------------------------
+ * Monotonic time in microseconds since the timer service started
+ * counting ticks, with the resolution of one PIT input clock (0.84 us).
+ * Needs the timer service. Wraps around after about 71 minutes, so
+ * only differences are meaningful. Changes of the rate with
+ * init_pit() start a new base, so the ticks before it are not counted
+ * with the new length.
+ */
+unsigned get_time_us()
+{
+	unsigned ticks, elapsed, us;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	read_clock(&ticks, &elapsed);
+	us = time_base_us + clock_to_us(ticks, elapsed);
+
+	ENABLE_INTR(saved_if);
+	return us;
+}
+
+
+/*
+ * add_timeout
+ *----------------------------------------------------------------------------
+ * Arranges for the timer process to wake up proc after ticks ticks if
+ * it is still receive blocked by then. Used by receive_timeout(). The
+ * returned timer must be released with cancel_timeout(), whether it
+ * expired or not.
+ */
+TIMER add_timeout(PROCESS proc, int ticks)
+{
+	Timer *t;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	t = arm_timer(proc, ticks, TIMER_TIMEOUT);
+
+	ENABLE_INTR(saved_if);
+	return t;
+}
+
+
+void cancel_timeout(TIMER t)
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	assert(t->type == TIMER_TIMEOUT && t->state != TIMER_FREE);
+	free_timer(t);
+
+	ENABLE_INTR(saved_if);
+}
+
+
+// wakes up a process whose receive_timeout() expired, called with
+// interrupts disabled right after the timer fired
+void wake_timeout(PROCESS proc)
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	if (proc->state == STATE_RECEIVE_BLOCKED)
+	{
+		proc->param_proc = NULL;
+		proc->param_port = NULL;
+		proc->param_data = NULL;
+		proc->param_len = 0;
+		add_ready_queue(proc);
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * periodic_timer
+ *----------------------------------------------------------------------------
+ * Creates a timer for the calling process that expires every period
+ * ticks, the first time period ticks from now. The timer interrupt
+ * re-arms it relative to its last deadline, so the rate does not drift
+ * and no IPC is needed per period.
+ */
+TIMER periodic_timer(int period)
+{
+	Timer *t;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	period = max(period, 1);
+	t = arm_timer(active_proc, period, TIMER_PERIODIC);
+	t->period = period;
+
+	ENABLE_INTR(saved_if);
+	return t;
+}
+
+
+/*
+ * wait_periodic
+ *----------------------------------------------------------------------------
+ * Blocks until periodic timer t expires. Returns the number of periods
+ * that expired since the last call, which is more than 1 if the caller
+ * fell behind.
+ */
+int wait_periodic(TIMER t)
+{
+	int n;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	assert(t->type == TIMER_PERIODIC && t->proc == active_proc);
+	if (t->expirations == 0)
+	{
+		t->waiting = TRUE;
+		active_proc->state = STATE_REPLY_BLOCKED;
+		remove_ready_queue(active_proc);
+		resign();
+	}
+	n = t->expirations;
+	t->expirations = 0;
+
+	ENABLE_INTR(saved_if);
+	return n;
+}
+
+
+void cancel_periodic(TIMER t)
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	assert(t->type == TIMER_PERIODIC && t->proc == active_proc);
+	free_timer(t);
+
+	ENABLE_INTR(saved_if);
 }
 
 void timer_process(PROCESS self, PARAM param)
 {
 	Timer_Message *msg;
 	PROCESS proc;
-	create_process(timer_notifier, 7, 0, "Timer notifier");
+	Timer *t;
+	int len;
+	BOOL timeout;
+
+	volatile int saved_if;
+
+	create_process_stack(timer_notifier, 7, 0, "Timer notifier", SMALL_STACK_SIZE);
 	while(1)
 	{
-		msg = (Timer_Message *)receive(&proc);
+		msg = (Timer_Message *)receive_buf(&proc, &len);
 		if (msg == NULL)
 		{
-			// message from timer_notifier
-			if(tml_head != NULL)
+			// message from timer_notifier: handle all expired timers
+			while(1)
 			{
-				tml_head->num_of_ticks--;
-				while((proc = pop_timer_list()) != NULL)
+				DISABLE_INTR(saved_if);
+				t = expired_timers;
+				if (t == NULL)
+				{
+					ENABLE_INTR(saved_if);
+					break;
+				}
+				proc = t->proc;
+				timeout = (t->type == TIMER_TIMEOUT);
+				if (timeout)
+				{
+					// released by cancel_timeout(). Wake proc before
+					// interrupts are enabled: afterwards it may have
+					// cancelled the timeout and blocked in another
+					// receive().
+					unlink_timer(&expired_timers, t);
+					t->state = TIMER_FIRED;
+					wake_timeout(proc);
+				}
+				else
+				{
+					free_timer(t);
+				}
+				ENABLE_INTR(saved_if);
+
+				if (!timeout)
 				{
 					reply(proc);
 				}
@@ -132,23 +659,51 @@ void timer_process(PROCESS self, PARAM param)
 		else
 		{
 			// message from process wishing to sleep
-			add_timer_list(msg->num_of_ticks, proc);
+			// send() gives a relative, sleep_until() an absolute time
+			DISABLE_INTR(saved_if);
+			if (len == 0)
+			{
+				arm_timer(proc, msg->num_of_ticks, TIMER_SLEEP);
+			}
+			else
+			{
+				arm_timer(proc, (int)(msg->until - _TOS_time), TIMER_SLEEP);
+			}
+			ENABLE_INTR(saved_if);
 		}
 	}
 }
 
 void init_timer ()
 {
-	Timer *t;
-	tml_head = tml + MAX_PROCS;
-	for(t = tml; t < tml_head; t++)
+	int i;
+	volatile int saved_if;
+
+	DISABLE_INTR(saved_if);
+	free_timers = NULL;
+	for (i = MAX_TIMERS - 1; i >= 0; i--)
 	{
-		t->num_of_ticks = 0;
-		t->next = NULL;
+		timer_pool[i].state = TIMER_FREE;
+		timer_pool[i].proc = NULL;
+		timer_pool[i].prev = NULL;
+		timer_pool[i].next = free_timers;
+		free_timers = &timer_pool[i];
 	}
-	tml_head = NULL;
+	for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+	{
+		timer_wheel[i] = NULL;
+	}
+	expired_timers = NULL;
+
+	// mode 2 instead of the BIOS' mode 3, so the count can be read
+	one_shot_ticks = 0;
+	pit_write_count(PIT_PERIODIC_0, pit_divisor);
+	ENABLE_INTR(saved_if);
 
 	timer_port = create_process(timer_process, 6, 0, "Timer process");
+	/* the notifier must not wait while the timer process is busy */
+	create_mailbox(timer_port, FALSE);
+	register_interrupt_handler(TIMER_IRQ, timer_wheel_intr_handler);
 
 	resign();
 }
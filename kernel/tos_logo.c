@@ -24,8 +24,10 @@ void draw_tos_logo(unsigned char *data)
 }
 
 
+// shows the animated logo for time milliseconds
 void tos_splash_screen(int time)
 {
+    TIMER timer;
 
     assert( start_graphic_vga() );
 
@@ -36,17 +38,19 @@ void tos_splash_screen(int time)
     // clear screen
     k_memset((unsigned char *)GRAPHICS_WINDOW_BASE_ADDR, 0x00, GRAPHICS_WINDOW_TOTAL_WIDTH * GRAPHICS_WINDOW_TOTAL_HEIGHT);
 
+    timer = periodic_timer(ms_to_ticks(LOGO_ANIMATION_SLIDE_TIME));
     while (time > 0)
     {
         // draw tos logo
         draw_tos_logo(header_data2);
-        sleep(LOGO_ANIMATION_SLIDE_TIME);
+        wait_periodic(timer);
 
         draw_tos_logo(header_data);
-        sleep(LOGO_ANIMATION_SLIDE_TIME);
+        wait_periodic(timer);
 
         time -= 2 * LOGO_ANIMATION_SLIDE_TIME;
     }
+    cancel_periodic(timer);
 
     set_colors(default_palette, 0);
 
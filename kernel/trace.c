@@ -0,0 +1,147 @@
+
+#include <kernel.h>
+
+/*
+ * Kernel event trace. Every record is TRACE_RECORD_SIZE (16) bytes:
+ * the time stamp counter, the event, the running process and two
+ * event specific arguments. The records go into a ring buffer of
+ * TRACE_SIZE entries; a slot is claimed with a single lock xadd on
+ * trace_next, so recording needs neither a lock nor disabled
+ * interrupts. When the ring is full the oldest records are
+ * overwritten.
+ *
+ * trace_dump() writes the ring to COM2 in the following format (all
+ * numbers little endian), which tools/trace/trace2json.py converts
+ * to the Chrome trace event format:
+ *
+ *	"TOSTRACE"		magic
+ *	u32			TRACE_VERSION
+ *	u32			number of records
+ *	u64 u32			TSC and get_time_us() when tracing started
+ *	u64 u32			TSC and get_time_us() at the time of the dump
+ *	records			oldest first
+ *	u32			number of processes
+ *	u8 u8 name		pcb index, length and name of every process
+ */
+
+#define TRACE_SIZE		4096	/* must be a power of 2 */
+#define TRACE_VERSION		1
+
+TRACE_RECORD trace_buffer[TRACE_SIZE];
+volatile unsigned trace_next;
+BOOL trace_enabled = FALSE;
+
+unsigned long long trace_start_tsc;
+unsigned trace_start_us;
+
+
+unsigned long long read_tsc()
+{
+	unsigned long long tsc;
+	asm volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+
+/*
+ * trace_record
+ *----------------------------------------------------------------------------
+ * Appends a record to the ring. Use the TRACE() macro, which skips the
+ * call while tracing is off.
+ */
+void trace_record(int event, int arg, unsigned data)
+{
+	TRACE_RECORD *r;
+	unsigned i = 1;
+
+	asm volatile ("lock xaddl %0, %1" : "+r" (i), "+m" (trace_next));
+	r = &trace_buffer[i & (TRACE_SIZE - 1)];
+	r->tsc = read_tsc();
+	r->event = event;
+	r->proc = active_proc - pcb;
+	r->arg = arg;
+	r->data = data;
+}
+
+
+/*
+ * trace_start
+ *----------------------------------------------------------------------------
+ * Empties the ring and starts recording.
+ */
+void trace_start()
+{
+	trace_enabled = FALSE;
+	trace_next = 0;
+	trace_start_us = get_time_us();
+	trace_start_tsc = read_tsc();
+	trace_enabled = TRUE;
+}
+
+
+void trace_stop()
+{
+	trace_enabled = FALSE;
+}
+
+
+void trace_put_u32(unsigned value)
+{
+	write_com2(&value, sizeof(value));
+}
+
+
+/*
+ * trace_dump
+ *----------------------------------------------------------------------------
+ * Stops tracing and writes the ring to COM2. Returns the number of
+ * records written.
+ */
+int trace_dump()
+{
+	unsigned long long tsc;
+	unsigned first, count, i;
+	unsigned num_procs;
+	unsigned char index, name_len;
+	PROCESS proc;
+
+	trace_stop();
+
+	count = min(trace_next, TRACE_SIZE);
+	first = trace_next - count;
+
+	write_com2("TOSTRACE", 8);
+	trace_put_u32(TRACE_VERSION);
+	trace_put_u32(count);
+	write_com2(&trace_start_tsc, sizeof(trace_start_tsc));
+	trace_put_u32(trace_start_us);
+	tsc = read_tsc();
+	write_com2(&tsc, sizeof(tsc));
+	trace_put_u32(get_time_us());
+
+	for (i = first; i != first + count; i++)
+	{
+		write_com2(&trace_buffer[i & (TRACE_SIZE - 1)], sizeof(TRACE_RECORD));
+	}
+
+	num_procs = 0;
+	for (proc = pcb; proc < pcb + MAX_PROCS; proc++)
+	{
+		if (proc->used == TRUE && proc->name != NULL)
+			num_procs++;
+	}
+	trace_put_u32(num_procs);
+
+	for (proc = pcb; proc < pcb + MAX_PROCS; proc++)
+	{
+		if (proc->used != TRUE || proc->name == NULL)
+			continue;
+		index = proc - pcb;
+		name_len = min(k_strlen(proc->name), 255);
+		write_com2(&index, 1);
+		write_com2(&name_len, 1);
+		write_com2(proc->name, name_len);
+	}
+
+	return count;
+}
@@ -12,7 +12,9 @@
 #define TOS_TRACK_NUMBER_SECTIONS 16
 #define TOS_TRACK_NUMBER_SWITCHES 9
 #define TOS_NUMBER_TRAINS 3
-#define TIME_MULTIPLIER 8000
+// milliseconds per unit of track length at speed 1, measured as 8000
+// ticks of the BIOS rate (18.2 Hz)
+#define TIME_MULTIPLIER 439403
 #define CARGO_PROCESS_NAME "Get Cargo process"
 
 static WINDOW train_window_def = {0, 0, 80 - MAZE_WIDTH, 10, 0, 0, '_'};
@@ -27,7 +29,7 @@ volatile BOOL TOS_train_getting_cargo;
 
 unsigned int last_cmd_sent = 0;
 
-int train_cmd_pause = 15;
+int train_cmd_pause = 824;	// milliseconds, 15 ticks at 18.2 Hz
 int TOS_track_length_time_multiplier = TIME_MULTIPLIER;
 int zamboni_default_speed = 5;
 int tos_switch_length = 1;
@@ -111,9 +113,10 @@ track_piece *find_next_piece(track_piece *trk1, track_piece *trk2);
 void send_train_com_msg(COM_Message *msg)
 {
 	unsigned int time_since_last_cmd = get_TOS_time() - last_cmd_sent;
+	unsigned int pause = ms_to_ticks(train_cmd_pause);
 
-	if ( time_since_last_cmd < train_cmd_pause )
-		sleep(train_cmd_pause - time_since_last_cmd);
+	if ( time_since_last_cmd < pause )
+		sleep(pause - time_since_last_cmd);
 
 	send(com_port, msg);
 
@@ -545,7 +548,7 @@ BOOL find_TOS_configuration(BOOL ignore_zamboni)
 	if (ignore_zamboni == FALSE)
 	{
 		// wait long enough for 3 round trips
-		wait_time = TOS_track_length_time_multiplier * 28 * 3 / (zamboni_default_speed * zamboni_default_speed);
+		wait_time = ms_to_ticks(TOS_track_length_time_multiplier * 28 * 3 / (zamboni_default_speed * zamboni_default_speed));
 
 		// find Zamboni
 		i = get_TOS_time();
@@ -566,7 +569,7 @@ BOOL find_TOS_configuration(BOOL ignore_zamboni)
 		if (black_train->position != NULL)
 		{
 			// wait long enough for 3 trips to segment 10 or 6
-			wait_time = TOS_track_length_time_multiplier * 4 * 3 / (zamboni_default_speed * zamboni_default_speed);
+			wait_time = ms_to_ticks(TOS_track_length_time_multiplier * 4 * 3 / (zamboni_default_speed * zamboni_default_speed));
 			i = get_TOS_time();
 			while (get_TOS_time() - i < wait_time)
 			{
@@ -1519,7 +1522,7 @@ int move_train_one_segment_time(train_train *trn, int speed, track_path *path, i
 	print_path(path, start, stop);
 
 	// wait until trn gets to track segment
-	sleep(get_path_time(path, speed, start, stop));
+	sleep(ms_to_ticks(get_path_time(path, speed, start, stop)));
 
 	train_update_position(trn, path, stop);
 
@@ -1584,7 +1587,7 @@ BOOL move_train_time(train_train *trn, int speed, track_path *path, int start, i
 	// wprintf(train_wnd, "estimated time %d\n", get_path_time(path, speed, start, stop));
 
 	// wait until trn gets to track segment
-	sleep(get_path_time(path, speed, start, stop));
+	sleep(ms_to_ticks(get_path_time(path, speed, start, stop)));
 
 	// stop at requested segment
 	set_speed(trn, 0);
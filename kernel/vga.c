@@ -111,6 +111,8 @@ int start_graphic_vga()
         return 1;
     }
 
+    // the text console may have moved the start address
+    reset_console_origin();
     save_graphics_memory(saved_text_memory);
 
     graphics_mode = VGA_MODE;
@@ -219,6 +221,7 @@ int start_text_mode()
     restore_graphics_memory(saved_text_memory);
 
     graphics_mode = TEXT_MODE;
+    flush_console();
 
     return 1;
 }
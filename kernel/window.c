@@ -1,27 +1,242 @@
 
 #include <kernel.h>
 
-typedef struct _buffer_window
+/*
+ * The text console is double buffered. Windows draw into
+ * console_cells, a copy of the VGA text memory in RAM, and every line
+ * remembers the columns that changed since the last flush.
+ * flush_console() copies only these dirty spans to VGA memory, so
+ * scrolling moves lines in RAM and the result goes out in one pass.
+ *
+ * The output functions flush before they return, unless
+ * console_deferred is set. Then the timer tick flushes the console,
+ * and so does the null process before it halts.
+ *
+ * With console_panning set, a window that covers the whole screen
+ * scrolls by moving the start address of the CRTC down instead of
+ * copying its lines, and only the new lines are flushed. The screen
+ * then begins at console_origin in VGA memory. When it would run past
+ * the end of VGA memory it starts over at the beginning and is drawn
+ * again from the back buffer. Windows that do not cover the screen
+ * scroll in the back buffer.
+ */
+
+#define CONSOLE_CELLS		(WINDOW_TOTAL_WIDTH * WINDOW_TOTAL_HEIGHT)
+#define CONSOLE_VRAM_CELLS	(0x8000 / sizeof(WORD))
+
+/* the cells as displayed */
+WORD console_cells[WINDOW_TOTAL_WIDTH * WINDOW_TOTAL_HEIGHT] __attribute__ ((aligned (4)));
+/* the characters as written, remove_char() needs tabs and newlines */
+unsigned char console_text[WINDOW_TOTAL_WIDTH * WINDOW_TOTAL_HEIGHT];
+
+/* columns [dirty_first, dirty_end) of each line are not flushed yet */
+int dirty_first[WINDOW_TOTAL_HEIGHT];
+int dirty_end[WINDOW_TOTAL_HEIGHT];
+BOOL console_dirty = FALSE;
+
+BOOL console_deferred = FALSE;
+
+BOOL console_panning = FALSE;
+/* first cell of the screen in VGA memory, and what the CRTC shows */
+int console_origin = 0;
+int crtc_origin = 0;
+
+
+// marks len cells from offset as dirty, all within one line
+void mark_dirty(int offset, int len)
 {
-	unsigned char buffer[2 * WINDOW_TOTAL_WIDTH * WINDOW_TOTAL_HEIGHT];
-} buffer_window;
+	int y = offset / WINDOW_TOTAL_WIDTH;
+	int x = offset % WINDOW_TOTAL_WIDTH;
 
-buffer_window kernel_buffer_window;
+	if (dirty_first[y] == dirty_end[y])
+	{
+		dirty_first[y] = x;
+		dirty_end[y] = x + len;
+	}
+	else
+	{
+		dirty_first[y] = min(dirty_first[y], x);
+		dirty_end[y] = max(dirty_end[y], x + len);
+	}
+	console_dirty = TRUE;
+}
 
-void write_char(int offset, unsigned char c)
+// the attribute wnd writes with now
+int window_attr(WINDOW* wnd)
 {
-	char d = c;
+	if (wnd->attr != 0)
+		return wnd->attr;
+	if (wnd->style != 0)
+		return wnd->style;
+	return WINDOW_DEFAULT_ATTR;
+}
+
+// fills len cells from offset with c in the colours of wnd, all within one line
+void fill_chars(WINDOW* wnd, int offset, int len, unsigned char c)
+{
+	WORD cell = c | window_attr(wnd) << 8;
+	int i;
+
 	if (c == '\t' || c == '\r' || c == '\n')
-		d = ' ';
-	poke_w((MEM_ADDR)((WORD*)WINDOW_BASE_ADDR + offset), d | 0x0F00);
-	poke_w((MEM_ADDR)((WORD*)kernel_buffer_window.buffer + offset), c | 0x0F00);
+		cell = ' ' | window_attr(wnd) << 8;
+	for (i = offset; i < offset + len; i++)
+	{
+		console_cells[i] = cell;
+		console_text[i] = c;
+	}
+	mark_dirty(offset, len);
 }
 
 unsigned char read_char(int offset)
 {
-	return peek_b((MEM_ADDR)((WORD*)kernel_buffer_window.buffer + offset));
+	return console_text[offset];
+}
+
+
+/*
+ * Copies n cells to VGA memory. Cells next to the span are not
+ * touched, they may differ from the back buffer if someone wrote to
+ * VGA memory directly. An odd first cell is copied on its own, so
+ * k_memcpy() can move the rest with movl.
+ */
+void copy_cells(WORD* dst, const WORD* src, int n)
+{
+	if (n > 0 && ((MEM_ADDR) dst & 2) != 0)
+	{
+		*dst++ = *src++;
+		n--;
+	}
+	k_memcpy(dst, src, n * sizeof(WORD));
+}
+
+void set_crtc_origin(int origin)
+{
+	outportb(0x3D4, 0x0C);
+	outportb(0x3D5, origin >> 8);
+	outportb(0x3D4, 0x0D);
+	outportb(0x3D5, origin & 0xFF);
+	crtc_origin = origin;
+}
+
+// the next flush draws the whole screen
+void redraw_console()
+{
+	int y;
+
+	for (y = 0; y < WINDOW_TOTAL_HEIGHT; y++)
+	{
+		dirty_first[y] = 0;
+		dirty_end[y] = WINDOW_TOTAL_WIDTH;
+	}
+	console_dirty = TRUE;
+}
+
+/*
+ * reset_console_origin
+ *----------------------------------------------------------------------------
+ * Moves the screen back to the start of VGA memory. Called by vga.c
+ * before it switches to graphics mode, which uses the same start
+ * address.
+ */
+void reset_console_origin()
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	set_crtc_origin(0);
+	console_origin = 0;
+	redraw_console();
+
+	ENABLE_INTR(saved_if);
+}
+
+/*
+ * pan_console
+ *----------------------------------------------------------------------------
+ * Scrolls the screen in VGA memory if wnd covers all of it. The lines
+ * still on the screen do not have to be flushed again, but their
+ * dirty spans move up with them. Returns FALSE if wnd has to be
+ * scrolled by copying.
+ */
+BOOL pan_console(WINDOW* wnd, int lines)
+{
+	int y;
+
+	if (!console_panning || lines >= WINDOW_TOTAL_HEIGHT
+	    || wnd->x != 0 || wnd->width != WINDOW_TOTAL_WIDTH
+	    || wnd->y != 0 || wnd->height != WINDOW_TOTAL_HEIGHT)
+		return FALSE;
+
+	for (y = 0; y + lines < WINDOW_TOTAL_HEIGHT; y++)
+	{
+		dirty_first[y] = dirty_first[y + lines];
+		dirty_end[y] = dirty_end[y + lines];
+	}
+	for ( ; y < WINDOW_TOTAL_HEIGHT; y++)
+	{
+		dirty_first[y] = dirty_end[y] = 0;
+	}
+
+	console_origin += lines * WINDOW_TOTAL_WIDTH;
+	if (console_origin + CONSOLE_CELLS > CONSOLE_VRAM_CELLS)
+	{
+		console_origin = 0;
+		redraw_console();
+	}
+	console_dirty = TRUE;
+	return TRUE;
+}
+
+
+/*
+ * flush_console
+ *----------------------------------------------------------------------------
+ * Copies the dirty spans of the back buffer to VGA memory.
+ * Nothing is copied while the VGA is in graphics mode; the spans stay
+ * dirty until it is back in text mode.
+ */
+void flush_console()
+{
+	int y, offset;
+
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	if (console_dirty && graphics_mode == TEXT_MODE)
+	{
+		for (y = 0; y < WINDOW_TOTAL_HEIGHT; y++)
+		{
+			if (dirty_first[y] == dirty_end[y])
+				continue;
+			offset = y * WINDOW_TOTAL_WIDTH + dirty_first[y];
+			copy_cells((WORD*)WINDOW_BASE_ADDR + console_origin + offset,
+				   console_cells + offset, dirty_end[y] - dirty_first[y]);
+			dirty_first[y] = dirty_end[y] = 0;
+		}
+		// the new lines are in place, now show them
+		if (console_origin != crtc_origin)
+			set_crtc_origin(console_origin);
+		console_dirty = FALSE;
+	}
+
+	ENABLE_INTR(saved_if);
+}
+
+// end of an output call: flush now, unless the next tick does it
+void update_console()
+{
+	if (!console_deferred)
+		flush_console();
+}
+
+// called on every timer tick
+void console_tick()
+{
+	if (console_deferred && console_dirty)
+		flush_console();
 }
 
+
 /* sets the currect cursor location to black ' ' */
 void move_cursor(WINDOW* wnd, int x, int y)
 {
@@ -36,14 +251,26 @@ void move_cursor(WINDOW* wnd, int x, int y)
 }
 
 
+void erase_cursor(WINDOW* wnd)
+{
+	fill_chars(wnd, WINDOW_OFFSET(wnd, wnd->cursor_x, wnd->cursor_y), 1, ' ');
+}
+
+void draw_cursor(WINDOW* wnd)
+{
+	fill_chars(wnd, WINDOW_OFFSET(wnd, wnd->cursor_x, wnd->cursor_y), 1, wnd->cursor_char);
+}
+
+
 void remove_cursor(WINDOW* wnd)
 {
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	write_char(WINDOW_OFFSET(wnd, wnd->cursor_x, wnd->cursor_y), ' ');
+	erase_cursor(wnd);
 
 	ENABLE_INTR(saved_if); 
+	update_console();
 }
 
 
@@ -52,9 +279,10 @@ void show_cursor(WINDOW* wnd)
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	write_char(WINDOW_OFFSET(wnd, wnd->cursor_x, wnd->cursor_y), wnd->cursor_char);
+	draw_cursor(wnd);
 
 	ENABLE_INTR(saved_if); 
+	update_console();
 }
 
 
@@ -63,40 +291,42 @@ void clear_window(WINDOW* wnd)
 	volatile int saved_if;
 	DISABLE_INTR(saved_if);
 
-	int offset_to_next_line = WINDOW_TOTAL_WIDTH - wnd->width;
-	int h_end, w_end;
-	int offset = WINDOW_OFFSET(wnd, 0, 0);
-	for (h_end = offset + wnd->height * WINDOW_TOTAL_WIDTH; offset < h_end; offset += offset_to_next_line)
+	int y;
+	for (y = 0; y < wnd->height; y++)
 	{
-		for (w_end = offset + wnd->width; offset < w_end; offset++)
-		{
-			write_char(offset, ' ');
-		}
+		fill_chars(wnd, WINDOW_OFFSET(wnd, 0, y), wnd->width, ' ');
 	}
 	move_cursor(wnd, 0, 0);
-	show_cursor(wnd);
+	draw_cursor(wnd);
 
 	ENABLE_INTR(saved_if);
+	update_console();
 }
 
 /* scrolls the window up lines number of lines, also moving the cursor */
 /* returns TRUE if scrolling would move the cursor off screen, FALSE otherwise */
 /* if cursor would move offscreen it is reset to position 0,0 */
+/* only the back buffer changes, the next flush updates the screen */
 BOOL scroll_window(WINDOW* wnd, int lines)
 {
-	int i;
+	int y;
 	int dst = WINDOW_OFFSET(wnd, 0, 0);
 	int src = dst + lines * WINDOW_TOTAL_WIDTH;
-	int end = dst + wnd->height * WINDOW_TOTAL_WIDTH;
-	for( ; src < end; src += WINDOW_TOTAL_WIDTH, dst += WINDOW_TOTAL_WIDTH)
+	BOOL panned = pan_console(wnd, lines);
+
+	for (y = lines; y < wnd->height; y++)
 	{
-		for(i = 0; i < wnd->width; i++)
-			write_char(dst + i, read_char(src + i));
+		k_memcpy(console_cells + dst, console_cells + src, wnd->width * sizeof(WORD));
+		k_memcpy(console_text + dst, console_text + src, wnd->width);
+		if (!panned)
+			mark_dirty(dst, wnd->width);
+		src += WINDOW_TOTAL_WIDTH;
+		dst += WINDOW_TOTAL_WIDTH;
 	}
-	for( ; dst < end; dst += WINDOW_TOTAL_WIDTH)
+	for (y = max(wnd->height - lines, 0); y < wnd->height; y++)
 	{
-		for(i = 0; i < wnd->width; i++)
-			write_char(dst + i, ' ');
+		fill_chars(wnd, dst, wnd->width, ' ');
+		dst += WINDOW_TOTAL_WIDTH;
 	}
 
 	if (wnd->cursor_y - lines >= 0)
@@ -107,7 +337,7 @@ BOOL scroll_window(WINDOW* wnd, int lines)
 	else
 	{
 		move_cursor(wnd, 0, 0);
-		show_cursor(wnd);
+		draw_cursor(wnd);
 		return TRUE;
 	}
 }
@@ -124,7 +354,7 @@ void remove_char(WINDOW* wnd)
 		// removing within a single line
 		c = read_char(WINDOW_OFFSET(wnd, wnd->cursor_x - 1, wnd->cursor_y));
 		// remove single character
-		remove_cursor(wnd);
+		erase_cursor(wnd);
 		move_cursor(wnd, wnd->cursor_x - 1, wnd->cursor_y);
 
 		if (c == '\t')
@@ -133,7 +363,7 @@ void remove_char(WINDOW* wnd)
 			// removing tabs
 			while (c == '\t' && wnd->cursor_x % TAB_SIZE != 0)
 			{
-				remove_cursor(wnd);
+				erase_cursor(wnd);
 				move_cursor(wnd, wnd->cursor_x - 1, wnd->cursor_y);
 				c = read_char(WINDOW_OFFSET(wnd, wnd->cursor_x - 1, wnd->cursor_y));
 			}
@@ -144,7 +374,7 @@ void remove_char(WINDOW* wnd)
 		// removing on previous line if it exists
 		c = read_char(WINDOW_OFFSET(wnd, wnd->width - 1, wnd->cursor_y - 1));
 		// move cursor to end of new line, removing single character
-		remove_cursor(wnd);
+		erase_cursor(wnd);
 		move_cursor(wnd, wnd->width - 1, wnd->cursor_y - 1);
 
 		if (c == '\n' || c == '\r')
@@ -153,7 +383,7 @@ void remove_char(WINDOW* wnd)
 			// removing newlines
 			while ((c == '\n' || c == '\r') && wnd->cursor_x > 0)
 			{
-				remove_cursor(wnd);
+				erase_cursor(wnd);
 				move_cursor(wnd, wnd->cursor_x - 1, wnd->cursor_y);
 				c = read_char(WINDOW_OFFSET(wnd, wnd->cursor_x - 1, wnd->cursor_y));
 			}
@@ -164,24 +394,22 @@ void remove_char(WINDOW* wnd)
 			// removing tabs
 			while (c == '\t' && wnd->cursor_x % TAB_SIZE != 0)
 			{
-				remove_cursor(wnd);
+				erase_cursor(wnd);
 				move_cursor(wnd, wnd->cursor_x - 1, wnd->cursor_y);
 				c = read_char(WINDOW_OFFSET(wnd, wnd->cursor_x - 1, wnd->cursor_y));
 			}
 		}
 	}
 
-	show_cursor(wnd);
+	draw_cursor(wnd);
 
 	ENABLE_INTR(saved_if); 
+	update_console();
 }
 
-void output_char(WINDOW* wnd, unsigned char c)
+// writes c and moves the cursor, without drawing it
+void lay_out_char(WINDOW* wnd, unsigned char c)
 {
-	volatile int saved_if;
-	DISABLE_INTR(saved_if);
-
-	int i;
 	int write = TRUE;
 	int offset;
 	int cursor_old_x = wnd->cursor_x;
@@ -214,8 +442,6 @@ void output_char(WINDOW* wnd, unsigned char c)
 			break;
 	}
 
-	remove_cursor(wnd);
-
 	if (cursor_new_y >= wnd->height)
 	{
 		write = !scroll_window(wnd, cursor_new_y - wnd->height + 1);
@@ -232,35 +458,146 @@ void output_char(WINDOW* wnd, unsigned char c)
 		if (cursor_new_x == 0)
 		{
 			// writing across a line, fill rest of line with said char
-			for(i = 0; i + cursor_old_x < wnd->width; i++)
-				write_char(offset + i, c);
+			fill_chars(wnd, offset, wnd->width - cursor_old_x, c);
 		}
 		else
 		{
 			// writing within a line, fill till get to new position
-			for(i = 0; i + cursor_old_x < cursor_new_x; i++)
-				write_char(offset + i, c);
+			fill_chars(wnd, offset, cursor_new_x - cursor_old_x, c);
 		}
 	}
+}
+
+
+void output_char(WINDOW* wnd, unsigned char c)
+{
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
 
-	show_cursor(wnd);
+	erase_cursor(wnd);
+	lay_out_char(wnd, c);
+	draw_cursor(wnd);
 
 	ENABLE_INTR(saved_if); 
+	update_console();
 }
 
 
+/* VGA colour numbers of the ANSI colours 0 - 7 */
+static const unsigned char ansi_colors[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+// applies the SGR parameter p to the attribute of wnd
+void set_graphic_rendition(WINDOW* wnd, int p)
+{
+	int style = (wnd->style != 0) ? wnd->style : WINDOW_DEFAULT_ATTR;
+	int attr = window_attr(wnd);
+
+	if (p == 0)
+	{
+		wnd->attr = 0;
+		return;
+	}
+	if (p == 1)
+		attr |= 0x08;
+	else if (p == 22)
+		attr &= ~0x08;
+	else if (p >= 30 && p <= 37)
+		attr = (attr & 0xF8) | ansi_colors[p - 30];
+	else if (p == 39)
+		attr = (attr & 0xF0) | (style & 0x0F);
+	else if (p >= 40 && p <= 47)
+		attr = (attr & 0x0F) | ansi_colors[p - 40] << 4;
+	else if (p == 49)
+		attr = (attr & 0x0F) | (style & 0xF0);
+	else if (p >= 90 && p <= 97)
+		attr = (attr & 0xF0) | 0x08 | ansi_colors[p - 90];
+	wnd->attr = attr;
+}
+
+/*
+ * parse_escape
+ *----------------------------------------------------------------------------
+ * s points to a CSI sequence, ESC [ followed by parameters separated
+ * by ';' and a final letter. A sequence ending in 'm' sets the colours
+ * of wnd, others are skipped. Returns the first character after the
+ * sequence.
+ */
+const unsigned char* parse_escape(WINDOW* wnd, const unsigned char* s)
+{
+	int p = 0;
 
+	for (s += 2; *s != '\0'; s++)
+	{
+		if (*s >= '0' && *s <= '9')
+		{
+			p = 10 * p + *s - '0';
+		}
+		else if (*s == ';')
+		{
+			set_graphic_rendition(wnd, p);
+			p = 0;
+		}
+		else
+		{
+			if (*s == 'm')
+				set_graphic_rendition(wnd, p);
+			return s + 1;
+		}
+	}
+	return s;
+}
+
+/*
+ * output_string
+ *----------------------------------------------------------------------------
+ * Same as output_char() for every character of str, in one critical
+ * section. A run of plain characters that ends before the last column
+ * is copied as one span; everything else, tabs, newlines and wrapping
+ * at the end of a line, goes through lay_out_char(). The cursor is
+ * drawn once at the end.
+ *
+ * Unlike output_char(), output_string() understands the ANSI colour
+ * escapes ESC [ n ; ... m for n = 0, 1, 22, 30 - 37, 39, 40 - 47, 49
+ * and 90 - 97. The colours stay with the window until they are reset
+ * to its style with ESC [ 0 m.
+ */
 void output_string(WINDOW* wnd, const char *str)
 {
-	// volatile int saved_if;
-	// DISABLE_INTR(saved_if);
+	const unsigned char *s = (const unsigned char*) str;
+	int n, i, offset;
+	WORD attr;
 
-	while(*str != '\0')
+	volatile int saved_if;
+	DISABLE_INTR(saved_if);
+
+	erase_cursor(wnd);
+	while (*s != '\0')
 	{
-		output_char(wnd, *str++);
+		for (n = 0; s[n] >= ' ' && wnd->cursor_x + n < wnd->width - 1; n++);
+		if (n == 0)
+		{
+			if (s[0] == '\033' && s[1] == '[')
+				s = parse_escape(wnd, s);
+			else
+				lay_out_char(wnd, *s++);
+			continue;
+		}
+
+		offset = WINDOW_OFFSET(wnd, wnd->cursor_x, wnd->cursor_y);
+		attr = window_attr(wnd) << 8;
+		for (i = 0; i < n; i++)
+		{
+			console_cells[offset + i] = s[i] | attr;
+		}
+		k_memcpy(console_text + offset, s, n);
+		mark_dirty(offset, n);
+		wnd->cursor_x += n;
+		s += n;
 	}
-	
-	// ENABLE_INTR(saved_if); 
+	draw_cursor(wnd);
+
+	ENABLE_INTR(saved_if); 
+	update_console();
 }
 
 
@@ -270,7 +607,11 @@ void output_string(WINDOW* wnd, const char *str)
  */
 #define MAXBUF (sizeof(long int) * 8)		 /* enough for binary */
 
-char *printnum(char *b, unsigned int u, int base,
+/* stores c at b unless b reached end, NULL for no end */
+#define PUTC(b, end, c) \
+    do { if ((end) == NULL || (b) < (end)) *(b) = (c); (b)++; } while (0)
+
+char *printnum(char *b, char *end, unsigned int u, int base,
 	       BOOL negflag, int length, BOOL ladjust,
 	       char padc, BOOL upcase)
 {
@@ -288,24 +629,24 @@ char *printnum(char *b, unsigned int u, int base,
     } while( u != 0 );
     
     if (negflag)
-	*b++ = '-';
+	PUTC(b, end, '-');
     
     size = &buf [MAXBUF - 1] - p;
     
     if (size < length && !ladjust) {
 	while (length > size) {
-	    *b++ = padc;
+	    PUTC(b, end, padc);
 	    length--;
 	}
     }
     
     while (++p != &buf [MAXBUF])
-	*b++ = *p;
+	PUTC(b, end, *p);
     
     if (size < length) {
 	/* must be ladjust */
 	while (length > size) {
-	    *b++ = padc;
+	    PUTC(b, end, padc);
 	    length--;
 	}
     }
@@ -345,7 +686,11 @@ char *printnum(char *b, unsigned int u, int base,
 #define ctod(c) ((c) - '0')
 
 
-void vsprintf(char *buf, const char *fmt, va_list argp)
+/*
+ * Formats into buf, but stops storing at end. Returns the end of the
+ * output as if there was no end.
+ */
+char *vformat(char *buf, char *end, const char *fmt, va_list argp)
 {
     char		*p;
     char		*p2;
@@ -360,7 +705,7 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
     
     while (*fmt != '\0') {
 	if (*fmt != '%') {
-	    *buf++ = *fmt++;
+	    PUTC(buf, end, *fmt++);
 	    continue;
 	}
 	fmt++;
@@ -413,12 +758,12 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 	case 'b':
 	case 'B':
 	    u = va_arg (argp, unsigned int);
-	    buf = printnum (buf, u, 2, FALSE, length, ladjust, padc, 0);
+	    buf = printnum (buf, end, u, 2, FALSE, length, ladjust, padc, 0);
 	    break;
 	    
 	case 'c':
 	    c = va_arg (argp, int);
-	    *buf++ = c;
+	    PUTC(buf, end, c);
 	    break;
 	    
 	case 'd':
@@ -430,13 +775,13 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 		u = -n;
 		negflag = TRUE;
 	    }
-	    buf = printnum (buf, u, 10, negflag, length, ladjust, padc, 0);
+	    buf = printnum (buf, end, u, 10, negflag, length, ladjust, padc, 0);
 	    break;
 	    
 	case 'o':
 	case 'O':
 	    u = va_arg (argp, unsigned int);
-	    buf = printnum (buf, u, 8, FALSE, length, ladjust, padc, 0);
+	    buf = printnum (buf, end, u, 8, FALSE, length, ladjust, padc, 0);
 	    break;
 	    
 	case 's':
@@ -450,7 +795,7 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 		    n++;
 		p = p2;
 		while (n < length) {
-		    *buf++ = ' ';
+		    PUTC(buf, end, ' ');
 		    n++;
 		}
 	    }
@@ -458,11 +803,11 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 	    while (*p != '\0') {
 		if (++n > prec && prec != -1)
 		    break;
-		*buf++ = *p++;
+		PUTC(buf, end, *p++);
 	    }
 	    if (n < length && ladjust) {
 		while (n < length) {
-		    *buf++ = ' ';
+		    PUTC(buf, end, ' ');
 		    n++;
 		}
 	    }
@@ -471,17 +816,17 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 	case 'u':
 	case 'U':
 	    u = va_arg (argp, unsigned int);
-	    buf = printnum (buf, u, 10, FALSE, length, ladjust, padc, 0);
+	    buf = printnum (buf, end, u, 10, FALSE, length, ladjust, padc, 0);
 	    break;
 	    
 	case 'x':
 	    u = va_arg (argp, unsigned int);
-	    buf = printnum (buf, u, 16, FALSE, length, ladjust, padc, 0);
+	    buf = printnum (buf, end, u, 16, FALSE, length, ladjust, padc, 0);
 	    break;
 	    
 	case 'X':
 	    u = va_arg (argp, unsigned int);
-	    buf = printnum (buf, u, 16, FALSE, length, ladjust, padc, 1);
+	    buf = printnum (buf, end, u, 16, FALSE, length, ladjust, padc, 1);
 	    break;
 	    
 	case '\0':
@@ -489,11 +834,49 @@ void vsprintf(char *buf, const char *fmt, va_list argp)
 	    break;
 	    
 	default:
-	    *buf++ = *fmt;
+	    PUTC(buf, end, *fmt);
 	}
 	fmt++;
     }
-    *buf = '\0';
+    return buf;
+}
+
+
+void vsprintf(char *buf, const char *fmt, va_list argp)
+{
+    *vformat(buf, NULL, fmt, argp) = '\0';
+}
+
+
+/*
+ * k_vsnprintf
+ *----------------------------------------------------------------------------
+ * Like vsprintf(), but writes at most size bytes including the
+ * terminating '\0'. Returns the length of the string in buf, which is
+ * less than the full output if it was cut off.
+ */
+int k_vsnprintf(char *buf, int size, const char *fmt, va_list argp)
+{
+    char *end;
+
+    assert(size > 0);
+    end = vformat(buf, buf + size - 1, fmt, argp);
+    if (end > buf + size - 1)
+	end = buf + size - 1;
+    *end = '\0';
+    return end - buf;
+}
+
+
+int k_snprintf(char *buf, int size, const char *fmt, ...)
+{
+    va_list	argp;
+    int		len;
+
+    va_start(argp, fmt);
+    len = k_vsnprintf(buf, size, fmt, argp);
+    va_end(argp);
+    return len;
 }
 
 
@@ -503,7 +886,7 @@ void wprintf(WINDOW* wnd, const char *fmt, ...)
     char	buf[160];
 
     va_start(argp, fmt);
-    vsprintf(buf, fmt, argp);
+    k_vsnprintf(buf, sizeof(buf), fmt, argp);
     va_end(argp);
     output_string(wnd, buf);
 }
@@ -513,15 +896,24 @@ static WINDOW kernel_window_def = {0, 0, 80, 25, 0, 0, ' '};
 WINDOW* kernel_window = &kernel_window_def;
 
 
+/*
+ * kprintf
+ *----------------------------------------------------------------------------
+ * Appends to the kernel log (see klog.c). Once init_klog() started the
+ * drain, the null process copies the log to kernel_window; before
+ * that the output goes to kernel_window right away.
+ */
 void kprintf(const char *fmt, ...)
 {
     va_list	  argp;
-    char	  buf[160];
+    char	  buf[KLOG_LINE_SIZE];
 
     va_start(argp, fmt);
-    vsprintf(buf, fmt, argp);
+    k_vsnprintf(buf, sizeof(buf), fmt, argp);
     va_end(argp);
-    output_string(kernel_window, buf);
+    klog_write(buf);
+    if (!klog_drain)
+	output_string(kernel_window, buf);
 }
 
 int k_sprintf(char *str, const char *fmt, ...)
@@ -281,7 +281,7 @@ void check_create_process(char* name,
 
    unsigned stack_pointer = this_process->esp;
 
-   if (peek_l(stack_pointer + 28 ) != (LONG) entry_point ) 
+   if (peek_l(stack_pointer + 32 ) != (LONG) entry_point ) 
    {
       test_result = 12;
       return;
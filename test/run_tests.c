@@ -33,7 +33,25 @@ function_pointer tests[] =  {
     test_isr_3,
     test_timer_1,
     test_com_1,
-    //test_fork_1,
+    test_dispatcher_8,
+    test_isr_4,
+    test_ipc_7,
+    test_ipc_8,
+    test_timer_2,
+    test_ipc_9,
+    test_ipc_10,
+    test_timer_3,
+    test_timer_4,
+    test_timer_5,
+    test_dispatcher_9,
+    test_trace_1,
+    test_null_1,
+    test_kill_1,
+    test_fork_1,
+    test_fork_2,
+    test_window_5,
+    test_window_6,
+    test_klog_1,
     NULL
 };
 
@@ -122,5 +140,8 @@ void run_selected_tests()
 
 void kernel_main()
 {
+#ifdef SMP
+    init_cpu_segments();
+#endif
     run_selected_tests();
 }
@@ -10,6 +10,7 @@ extern int k_memcmp(const void* b1, const void* b2, int len);
 int test_strlen_1();
 int test_memcpy_1();
 int test_memcpy_2();
+int test_memcpy_3();
 int test_memcmp_1();
 int test_memcmp_2();
 
@@ -27,6 +28,7 @@ int main()
 	RUN_TEST(test_strlen_1);
 	RUN_TEST(test_memcpy_1);
 	RUN_TEST(test_memcpy_2);
+	RUN_TEST(test_memcpy_3);
 	RUN_TEST(test_memcmp_1);
 	RUN_TEST(test_memcmp_2);
 
@@ -80,6 +82,39 @@ int test_memcpy_2()
 	return (TEST_OK);
 }
 
+int test_memcpy_3()
+{
+	unsigned src_buf[10];
+	unsigned dst_buf[10];
+	char* src = (char*)src_buf;
+	char* dst = (char*)dst_buf;
+	int s_off, d_off, l, i;
+
+	for (i = 0; i < 40; i++)
+		src[i] = 'a' + i;
+
+	/* aligned and unaligned buffers, all lengths */
+	for (s_off = 0; s_off < 4; s_off++) {
+		for (d_off = 0; d_off < 4; d_off++) {
+			for (l = 0; l <= 32; l++) {
+				for (i = 0; i < 40; i++)
+					dst[i] = 'x';
+				k_memcpy(dst + d_off, src + s_off, l);
+				for (i = 0; i < 40; i++) {
+					if (i >= d_off && i < d_off + l) {
+						if (dst[i] != src[s_off + i - d_off])
+							return (1);
+					} else if (dst[i] != 'x') {
+						return (2);
+					}
+				}
+			}
+		}
+	}
+
+	return (TEST_OK);
+}
+
 int test_memcmp_1()
 {
 	char a1[] = { 'a', 'b', 'c', 'd' };
@@ -0,0 +1,146 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+/*
+ * Context switch microbenchmark. Two processes of priority 2
+ * ping-pong with resign(), while the lower ready queue is kept
+ * populated with filler processes that never run. On every switch
+ * the running process also unblocks/blocks the last filler, the way
+ * a server does with its clients, so the cost of add_ready_queue()
+ * and remove_ready_queue() is included in the measurement.
+ *
+ * The number of CPU cycles per switch is printed.
+ *
+ * For a reference in the same binary, the lookups of a switch are then
+ * timed twice with the fillers still queued: with the bitmap of the
+ * kernel (dispatcher() and on_ready_queue), and with the linear scan
+ * of the ready queues and the walk of the ring that the kernel used
+ * before the bitmap.
+ */
+
+#define TEST_DISPATCHER_8_ROUNDS  10000
+#define TEST_DISPATCHER_8_FILLERS 12
+
+PROCESS test_dispatcher_8_last_filler;
+
+unsigned long long test_dispatcher_8_rdtsc()
+{
+    unsigned long long tsc;
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/* dispatcher() before the priority bitmap */
+PROCESS test_dispatcher_8_linear_dispatcher()
+{
+    int prio;
+    PROCESS proc = NULL;
+    volatile int saved_if;
+    DISABLE_INTR(saved_if);
+
+    for (prio = MAX_READY_QUEUES - 1; prio >= 0; prio--) {
+	if (ready_queue[prio] == NULL)
+	    continue;
+	else if (prio == active_proc->priority) {
+	    proc = active_proc->next;
+	    break;
+	} else {
+	    proc = ready_queue[prio];
+	    break;
+	}
+    }
+    ENABLE_INTR(saved_if);
+    return proc;
+}
+
+/* in_ready_queue() before the on_ready_queue flag */
+BOOL test_dispatcher_8_ring_walk(PROCESS proc)
+{
+    PROCESS rq_proc = ready_queue[proc->priority];
+
+    if (rq_proc != NULL) {
+	do {
+	    if (rq_proc == proc)
+		return TRUE;
+	    rq_proc = rq_proc->next;
+	} while (rq_proc != ready_queue[proc->priority]);
+    }
+    return FALSE;
+}
+
+void test_dispatcher_8_filler(PROCESS self, PARAM param)
+{
+    /* should never run */
+    test_failed(26);
+}
+
+void test_dispatcher_8_process(PROCESS self, PARAM param)
+{
+    int i;
+
+    for (i = 0; i < TEST_DISPATCHER_8_ROUNDS; i++) {
+	remove_ready_queue(test_dispatcher_8_last_filler);
+	add_ready_queue(test_dispatcher_8_last_filler);
+	check_sum++;
+	resign();
+    }
+    if (param)
+	return_to_boot();
+    /* the first process to finish waits for the second one */
+    remove_ready_queue(self);
+    resign();
+    test_failed(26);
+}
+
+void test_dispatcher_8()
+{
+    unsigned long long start;
+    unsigned cycles, bitmap_cycles, linear_cycles;
+    PROCESS expected;
+    int i;
+
+    test_reset();
+    kprintf("=== test_dispatcher_8 ===\n");
+    kprintf("Measuring cycles per context switch.\n\n");
+
+    for (i = 0; i < TEST_DISPATCHER_8_FILLERS; i++)
+	create_process(test_dispatcher_8_filler, 1, 0, "Filler");
+    test_dispatcher_8_last_filler = ready_queue[1]->prev;
+
+    create_process(test_dispatcher_8_process, 2, 0, "Ping");
+    create_process(test_dispatcher_8_process, 2, 1, "Pong");
+
+    check_sum = 0;
+    start = test_dispatcher_8_rdtsc();
+    resign();
+    cycles = (unsigned) (test_dispatcher_8_rdtsc() - start);
+
+    if (check_sum != 2 * TEST_DISPATCHER_8_ROUNDS)
+	test_failed(25);
+
+    kprintf("%d switches: %u cycles per switch\n",
+	    check_sum, cycles / check_sum);
+
+    /* the same lookups, with the bitmap and with the linear scan */
+    expected = dispatcher();
+    start = test_dispatcher_8_rdtsc();
+    for (i = 0; i < TEST_DISPATCHER_8_ROUNDS; i++)
+	if (dispatcher() != expected ||
+	    !test_dispatcher_8_last_filler->on_ready_queue)
+	    test_failed(25);
+    bitmap_cycles = (unsigned) (test_dispatcher_8_rdtsc() - start);
+
+    start = test_dispatcher_8_rdtsc();
+    for (i = 0; i < TEST_DISPATCHER_8_ROUNDS; i++)
+	if (test_dispatcher_8_linear_dispatcher() != expected ||
+	    !test_dispatcher_8_ring_walk(test_dispatcher_8_last_filler))
+	    test_failed(25);
+    linear_cycles = (unsigned) (test_dispatcher_8_rdtsc() - start);
+
+    kprintf("lookups with bitmap:      %u cycles\n",
+	    bitmap_cycles / TEST_DISPATCHER_8_ROUNDS);
+    kprintf("lookups with linear scan: %u cycles\n",
+	    linear_cycles / TEST_DISPATCHER_8_ROUNDS);
+}
@@ -0,0 +1,72 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the per-process CPU accounting.
+ * 1. A process that ran once and blocked has one dispatch and one
+ *    voluntary switch.
+ * 2. Ticks spent blocked are charged to the state the process is
+ *    blocked in.
+ * 3. A process that is interrupted by a timer that wakes up a higher
+ *    priority process counts a preemption. Ticks spent running are
+ *    charged to cpu_ticks.
+ */
+
+void test_dispatcher_9_receiver(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    receive(&sender);
+}
+
+void test_dispatcher_9_sleeper(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    sleep(1);
+    receive(&sender);
+}
+
+void test_dispatcher_9()
+{
+    PROCESS helper;
+    PROC_STATS stats;
+    PROC_STATS boot_stats;
+    unsigned start;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_dispatcher_9 ===\n");
+
+    helper = create_process(test_dispatcher_9_receiver, 5, 0, "Receiver")->owner;
+    resign();
+
+    get_proc_stats(helper, &stats);
+    if (stats.dispatches != 1 || stats.voluntary != 1 || stats.preempted != 0)
+	test_failed(65);
+
+    get_proc_stats(active_proc, &boot_stats);
+    sleep(3);
+    get_proc_stats(helper, &stats);
+    if (stats.state_ticks[STATE_RECEIVE_BLOCKED] < 2)
+	test_failed(65);
+    get_proc_stats(active_proc, &stats);
+    if (stats.state_ticks[STATE_REPLY_BLOCKED] -
+	boot_stats.state_ticks[STATE_REPLY_BLOCKED] < 2)
+	test_failed(65);
+
+    /* the sleeper preempts us while we are busy */
+    create_process(test_dispatcher_9_sleeper, 5, 0, "Sleeper");
+    resign();
+    start = get_TOS_time();
+    while (get_TOS_time() - start < 3);
+    get_proc_stats(active_proc, &boot_stats);
+    if (boot_stats.preempted == stats.preempted)
+	test_failed(65);
+    if (boot_stats.cpu_ticks - stats.cpu_ticks < 2)
+	test_failed(65);
+}
@@ -0,0 +1,96 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks fork() from a process created with
+ * create_process() and compares the cost of both.
+ * 1. The child returns from fork() with NULL, the parent with the
+ *    child. The child has its own copy of the locals of the parent,
+ *    and a pointer to a local refers to the child's copy.
+ * 2. TEST_FORK_2_SPAWNS processes are spawned with create_process()
+ *    and with fork(), and the number of CPU cycles per spawn is
+ *    printed.
+ */
+
+#define TEST_FORK_2_SPAWNS	8
+
+int test_fork_2_children;
+BOOL test_fork_2_done;
+
+void test_fork_2_idle(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    receive(&sender);
+}
+
+void test_fork_2_process(PROCESS self, PARAM param)
+{
+    PROCESS child[TEST_FORK_2_SPAWNS];
+    PROCESS proc;
+    unsigned long long start;
+    unsigned create_cycles, fork_cycles;
+    int local, i;
+    int * volatile p = &local;
+
+    local = 42;
+    proc = fork();
+    if (proc == NULL) {
+	/* the child */
+	if (local != 42 || active_proc == self)
+	    test_failed(69);
+	*p = 7;
+	if (local != 7)
+	    test_failed(69);
+	test_fork_2_children++;
+	exit();
+    }
+    resign();
+    if (test_fork_2_children != 1 || local != 42)
+	test_failed(69);
+    if (proc->priority != self->priority || proc->first_port == NULL)
+	test_failed(69);
+
+    start = read_tsc();
+    for (i = 0; i < TEST_FORK_2_SPAWNS; i++)
+	child[i] = create_process(test_fork_2_idle, 1, 0, "Idle")->owner;
+    create_cycles = (unsigned) (read_tsc() - start);
+    for (i = 0; i < TEST_FORK_2_SPAWNS; i++)
+	kill_process(child[i], FALSE);
+
+    test_fork_2_children = 0;
+    start = read_tsc();
+    for (i = 0; i < TEST_FORK_2_SPAWNS; i++) {
+	child[i] = fork();
+	if (child[i] == NULL) {
+	    test_fork_2_children++;
+	    exit();
+	}
+    }
+    fork_cycles = (unsigned) (read_tsc() - start);
+    for (i = 0; i < TEST_FORK_2_SPAWNS && test_fork_2_children < TEST_FORK_2_SPAWNS; i++)
+	resign();
+    if (test_fork_2_children != TEST_FORK_2_SPAWNS)
+	test_failed(69);
+
+    kprintf("create_process(): %u cycles per spawn\n",
+	    create_cycles / TEST_FORK_2_SPAWNS);
+    kprintf("fork():           %u cycles per spawn\n",
+	    fork_cycles / TEST_FORK_2_SPAWNS);
+    test_fork_2_done = TRUE;
+    return_to_boot();
+}
+
+void test_fork_2()
+{
+    test_reset();
+    kprintf("=== test_fork_2 ===\n");
+
+    test_fork_2_children = 0;
+    test_fork_2_done = FALSE;
+    create_process(test_fork_2_process, 3, 0, "Parent");
+    resign();
+
+    if (!test_fork_2_done)
+	test_failed(69);
+}
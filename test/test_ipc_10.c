@@ -0,0 +1,83 @@
+#include <kernel.h>
+#include <test.h>
+
+
+
+/*
+ * This test demonstrates the priority inversion fixed by priority
+ * inheritance. A server of priority 2 serves a client of priority 6.
+ * A busy process of priority 4 keeps the CPU for a long time. Without
+ * inheritance the server, and thereby the client, has to wait until
+ * the busy process is done. With inheritance on the server's port the
+ * server runs at priority 6 while the client waits for it, so the
+ * client is done first. Afterwards the server has to be back at its
+ * own priority.
+ */
+
+BOOL test_ipc_10_client_done;
+BOOL test_ipc_10_busy_done;
+int  test_ipc_10_server_prio;
+
+void test_ipc_10_server(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    while (1) {
+	receive(&sender);
+	test_ipc_10_server_prio = self->priority;
+	reply(sender);
+    }
+}
+
+void test_ipc_10_busy(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int i;
+
+    for (i = 0; i < 10000; i++)
+	resign();
+    if (!test_ipc_10_client_done)
+	test_ipc_10_busy_done = TRUE;
+    receive(&sender);
+}
+
+void test_ipc_10_client(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    send((PORT) param, NULL);
+    test_ipc_10_client_done = TRUE;
+    receive(&sender);
+}
+
+void test_ipc_10()
+{
+    PORT server_port;
+    PROCESS server;
+
+    test_reset();
+    kprintf("=== test_ipc_10 === \n");
+
+    test_ipc_10_client_done = FALSE;
+    test_ipc_10_busy_done = FALSE;
+    test_ipc_10_server_prio = -1;
+
+    server_port = create_process(test_ipc_10_server, 2, 0, "Server");
+    server = server_port->owner;
+    set_port_inheritance(server_port, TRUE);
+    resign();
+
+    create_process(test_ipc_10_busy, 4, 0, "Busy");
+    create_process(test_ipc_10_client, 6, (PARAM) server_port, "Client");
+    resign();
+
+    if (!test_ipc_10_client_done || test_ipc_10_busy_done)
+	test_failed(64);
+    if (test_ipc_10_server_prio != 6)
+	test_failed(64);
+    if (server->priority != 2 || server->base_priority != 2)
+	test_failed(64);
+    check_process("Server", STATE_RECEIVE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+}
@@ -0,0 +1,103 @@
+#include <kernel.h>
+#include <test.h>
+
+
+
+/*
+ * This test checks the size-aware IPC functions. The receiver first
+ * gets a buffer with receive_buf() while it is receive blocked: the
+ * buffer must not be copied and the length must be passed along.
+ * Then it receives a larger buffer with receive_copy() into a smaller
+ * local buffer. Finally the boot process receives with receive_copy()
+ * from a sender that is already send blocked.
+ */
+
+char test_ipc_7_buf[200];
+
+BOOL test_ipc_7_check(char* buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+	if (buf[i] != (char) i)
+	    return FALSE;
+    return TRUE;
+}
+
+void test_ipc_7_receiver(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    char local[64];
+    char* data;
+    int len;
+
+    data = receive_buf(&sender, &len);
+    if (data != test_ipc_7_buf || len != 100)
+	test_failed(61);
+    reply(sender);
+
+    k_memset(local, 0, sizeof(local));
+    len = receive_copy(&sender, local, sizeof(local));
+    if (len != 200 || !test_ipc_7_check(local, sizeof(local)))
+	test_failed(61);
+
+    /* the sender continued with message_buf() and may reuse its buffer */
+    test_ipc_7_buf[0] = 42;
+    receive(&sender);
+}
+
+void test_ipc_7_sender(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    send_buf((PORT) param, test_ipc_7_buf, 48);
+    receive(&sender);
+}
+
+void test_ipc_7()
+{
+    PORT receiver_port;
+    PORT boot_port;
+    PROCESS sender;
+    char local[64];
+    int i;
+
+    test_reset();
+    kprintf("=== test_ipc_7 === \n");
+
+    for (i = 0; i < 200; i++)
+	test_ipc_7_buf[i] = i;
+
+    receiver_port = create_process(test_ipc_7_receiver, 5, 0, "Receiver");
+    resign();
+    check_process("Receiver", STATE_RECEIVE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+
+    send_buf(receiver_port, test_ipc_7_buf, 100);
+    check_process("Receiver", STATE_RECEIVE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+
+    message_buf(receiver_port, test_ipc_7_buf, 200);
+    if (test_ipc_7_buf[0] != 42)
+	test_failed(61);
+    test_ipc_7_buf[0] = 0;
+
+    /* sender blocks before the boot process receives */
+    boot_port = create_port();
+    create_process(test_ipc_7_sender, 5, (PARAM) boot_port, "Sender");
+    resign();
+    check_process("Sender", STATE_SEND_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+
+    k_memset(local, 0, sizeof(local));
+    if (receive_copy(&sender, local, sizeof(local)) != 48)
+	test_failed(61);
+    if (!test_ipc_7_check(local, 48) || local[48] != 0)
+	test_failed(61);
+    if (sender != find_process_by_name("Sender"))
+	test_failed(61);
+    reply(sender);
+}
@@ -0,0 +1,76 @@
+#include <kernel.h>
+#include <test.h>
+
+
+
+/*
+ * This test checks ports with a mailbox. The sender can queue
+ * MAILBOX_SIZE messages with message() without waiting for the
+ * boot process. The next message blocks it until the boot process
+ * makes room. Messages must arrive in the order they were sent.
+ * A mailbox in drop mode never blocks the sender but counts the
+ * messages that did not fit.
+ */
+
+PORT test_ipc_8_drop_port;
+
+void test_ipc_8_sender(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int i;
+
+    for (i = 0; i <= MAILBOX_SIZE; i++)
+	message((PORT) param, (void*) i);
+
+    for (i = 0; i < MAILBOX_SIZE + 4; i++)
+	message(test_ipc_8_drop_port, (void*) i);
+
+    receive(&sender);
+}
+
+void test_ipc_8()
+{
+    PORT boot_port;
+    PROCESS sender;
+    int i;
+
+    test_reset();
+    kprintf("=== test_ipc_8 === \n");
+
+    boot_port = create_port();
+    create_mailbox(boot_port, FALSE);
+    test_ipc_8_drop_port = create_port();
+    create_mailbox(test_ipc_8_drop_port, TRUE);
+
+    create_process(test_ipc_8_sender, 5, (PARAM) boot_port, "Sender");
+    resign();
+
+    /* the ring is full and the last message blocked the sender */
+    check_process("Sender", STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+    if (boot_port->mailbox->depth != MAILBOX_SIZE)
+	test_failed(62);
+
+    for (i = 0; i <= MAILBOX_SIZE; i++) {
+	if ((int) receive(&sender) != i)
+	    test_failed(62);
+	if (i == 0) {
+	    /* taking one message made room for the blocked sender */
+	    check_process("Sender", STATE_READY, TRUE);
+	    if (test_result != 0)
+		test_failed(test_result);
+	}
+    }
+    if (boot_port->mailbox->depth != 0
+	|| boot_port->mailbox->max_depth != MAILBOX_SIZE)
+	test_failed(62);
+
+    resign();
+    check_process("Sender", STATE_RECEIVE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+    if (test_ipc_8_drop_port->mailbox->depth != MAILBOX_SIZE
+	|| test_ipc_8_drop_port->mailbox->drops != 4)
+	test_failed(62);
+}
@@ -0,0 +1,106 @@
+#include <kernel.h>
+#include <test.h>
+
+
+
+/*
+ * This test checks receive_port() and receive_select(). The boot
+ * process owns three ports A, B and C. Three senders send to them.
+ * The boot process must get exactly the message of the port(s) it
+ * asks for, even though C is newer and would be served first by
+ * receive(). Finally the boot process blocks on A only: a message
+ * to B must not wake it up. Then the boot process creates so many
+ * more ports that they do not fit in one word of a PORT_SET, and
+ * receives on the last one.
+ */
+
+#define TEST_IPC_9_PORTS	48
+
+PORT test_ipc_9_port[TEST_IPC_9_PORTS];
+
+void test_ipc_9_sender(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    send(test_ipc_9_port[param], (void*) (param + 1));
+    receive(&sender);
+}
+
+void test_ipc_9_helper(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    message(test_ipc_9_port[1], (void*) 4);
+    send(test_ipc_9_port[0], (void*) 5);
+    receive(&sender);
+}
+
+void test_ipc_9()
+{
+    PROCESS sender;
+    PORT from;
+    PORT_SET set;
+    void* data;
+    int i;
+
+    test_reset();
+    kprintf("=== test_ipc_9 === \n");
+
+    for (i = 0; i < 3; i++)
+	test_ipc_9_port[i] = create_port();
+    for (i = 0; i < 3; i++)
+	create_process(test_ipc_9_sender, 5, i, "Sender");
+    resign();
+
+    data = receive_port(test_ipc_9_port[0], &sender);
+    if (data != (void*) 1)
+	test_failed(63);
+    reply(sender);
+
+    PORT_SET_CLEAR(set);
+    PORT_SET_ADD(set, test_ipc_9_port[1]);
+    data = receive_select(&set, &sender, &from);
+    if (data != (void*) 2 || from != test_ipc_9_port[1])
+	test_failed(63);
+    reply(sender);
+
+    PORT_SET_CLEAR(set);
+    PORT_SET_ADD(set, test_ipc_9_port[0]);
+    PORT_SET_ADD(set, test_ipc_9_port[2]);
+    data = receive_select(&set, &sender, &from);
+    if (data != (void*) 3 || from != test_ipc_9_port[2])
+	test_failed(63);
+    reply(sender);
+
+    if (check_messages(active_proc))
+	test_failed(63);
+
+    /* the helper runs while the boot process is blocked on A */
+    create_mailbox(test_ipc_9_port[1], FALSE);
+    create_process(test_ipc_9_helper, 1, 0, "Helper");
+    data = receive_port(test_ipc_9_port[0], &sender);
+    if (data != (void*) 5)
+	test_failed(63);
+    reply(sender);
+
+    if (!check_messages(active_proc))
+	test_failed(63);
+    data = receive_port(test_ipc_9_port[1], &sender);
+    if (data != (void*) 4)
+	test_failed(63);
+
+    for (i = 3; i < TEST_IPC_9_PORTS; i++)
+	test_ipc_9_port[i] = create_port();
+    i = TEST_IPC_9_PORTS - 1;
+    create_process(test_ipc_9_sender, 5, i, "Sender");
+    resign();
+    PORT_SET_CLEAR(set);
+    PORT_SET_ADD(set, test_ipc_9_port[0]);
+    PORT_SET_ADD(set, test_ipc_9_port[i]);
+    data = receive_select(&set, &sender, &from);
+    if (data != (void*) (i + 1) || from != test_ipc_9_port[i])
+	test_failed(63);
+    reply(sender);
+    if (check_messages(active_proc))
+	test_failed(63);
+}
@@ -0,0 +1,86 @@
+#include <kernel.h>
+#include <test.h>
+
+
+
+/*
+ * This test checks the multiplexing of the 16 PIC lines. After
+ * init_interrupts() only the timer and the cascade line may be
+ * unmasked. Registering a handler unmasks its line and the handler
+ * is called for its vector. An IRQ 7 that is not in service in the
+ * PIC is spurious: it is counted and not handed to the handler.
+ * Finally a process waits for an otherwise unused line. An interrupt
+ * that occurs while it is not waiting must not be lost.
+ */
+
+#define TEST_ISR_4_IRQ (IRQ_BASE + 5)
+
+int test_isr_4_count;
+
+void test_isr_4_handler(int intr_no)
+{
+    test_isr_4_count++;
+}
+
+void test_isr_4_process(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    wait_for_interrupt(TEST_ISR_4_IRQ);
+    test_isr_4_count++;
+
+    /* the interrupt is raised while this process is receive blocked */
+    receive(&sender);
+    wait_for_interrupt(TEST_ISR_4_IRQ);
+    test_isr_4_count++;
+    reply(sender);
+
+    while (1)
+	wait_for_interrupt(TEST_ISR_4_IRQ);
+}
+
+void test_isr_4()
+{
+    unsigned spurious;
+    PORT isr_port;
+
+    test_reset();
+    kprintf("=== test_isr_4 === \n");
+    init_interrupts();
+
+    /* only the timer (IRQ 0) and the cascade (IRQ 2) are unmasked */
+    if (inportb(0x21) != 0xfa || inportb(0xA1) != 0xff)
+	test_failed(74);
+
+    test_isr_4_count = 0;
+    register_interrupt_handler(IDE_IRQ, test_isr_4_handler);
+    if (inportb(0xA1) != 0xbf)
+	test_failed(74);
+    asm ("int $0x6e");
+    if (test_isr_4_count != 1)
+	test_failed(74);
+    register_interrupt_handler(IDE_IRQ, NULL);
+    if (inportb(0xA1) != 0xff)
+	test_failed(74);
+
+    test_isr_4_count = 0;
+    spurious = spurious_irqs;
+    register_interrupt_handler(IRQ_BASE + 7, test_isr_4_handler);
+    asm ("int $0x67");
+    register_interrupt_handler(IRQ_BASE + 7, NULL);
+    if (spurious_irqs != spurious + 1 || test_isr_4_count != 0)
+	test_failed(74);
+
+    test_isr_4_count = 0;
+    isr_port = create_process(test_isr_4_process, 5, 0, "ISR process");
+    resign();
+    if ((inportb(0x21) & 0x20) != 0)
+	test_failed(74);
+    asm ("int $0x65");
+    if (test_isr_4_count != 1)
+	test_failed(74);
+    asm ("int $0x65");
+    send(isr_port, NULL);
+    if (test_isr_4_count != 2)
+	test_failed(74);
+}
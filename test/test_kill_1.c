@@ -0,0 +1,112 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks that kill_process() detaches the victim from
+ * everything it is blocked on or blocks.
+ * 1. A server is killed while one client is reply blocked on it and
+ *    another one is send blocked on its port. Both continue, with
+ *    send() returning FALSE. A send() to the removed port fails too.
+ * 2. A send blocked client is killed. It is no longer pending on the
+ *    port of the server.
+ * 3. A process waiting for an interrupt is killed, which frees the
+ *    interrupt.
+ * 4. A process cannot kill itself.
+ */
+
+#define TEST_KILL_1_INTR	0x30
+
+PORT test_kill_1_port;
+int  test_kill_1_result[2];
+
+void test_kill_1_server(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    /* take the first message, never reply */
+    receive(&sender);
+    receive_port(create_port(), &sender);
+}
+
+void test_kill_1_client(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    test_kill_1_result[param] = send(test_kill_1_port, NULL);
+    receive(&sender);
+}
+
+void test_kill_1_waiter(PROCESS self, PARAM param)
+{
+    wait_for_interrupt(TEST_KILL_1_INTR);
+}
+
+void test_kill_1()
+{
+    PORT server_port;
+    PROCESS server, client[2], waiter;
+    int i;
+
+    test_reset();
+    kprintf("=== test_kill_1 === \n");
+
+    server_port = create_process(test_kill_1_server, 5, 0, "Server");
+    server = server_port->owner;
+    test_kill_1_port = server_port;
+    resign();
+
+    for (i = 0; i < 2; i++)
+    {
+	test_kill_1_result[i] = -1;
+	client[i] = create_process(test_kill_1_client, 4, i, "Client")->owner;
+    }
+    resign();
+
+    if (client[0]->state != STATE_REPLY_BLOCKED
+	|| client[1]->state != STATE_SEND_BLOCKED)
+	test_failed(68);
+
+    /* a message is waiting for the server */
+    if (kill_process(server, FALSE))
+	test_failed(68);
+    if (!kill_process(server, TRUE))
+	test_failed(68);
+    resign();
+
+    if (test_kill_1_result[0] != FALSE || test_kill_1_result[1] != FALSE)
+	test_failed(68);
+    if (send(server_port, NULL))
+	test_failed(68);
+
+    /* a send blocked client */
+    server_port = create_process(test_kill_1_server, 5, 0, "Server");
+    server = server_port->owner;
+    test_kill_1_port = server_port;
+    resign();
+    /* the first message is taken, the second one stays pending */
+    client[0] = create_process(test_kill_1_client, 4, 0, "Client")->owner;
+    client[1] = create_process(test_kill_1_client, 4, 1, "Client")->owner;
+    resign();
+
+    if (client[1]->state != STATE_SEND_BLOCKED || !check_messages(server))
+	test_failed(68);
+    if (!kill_process(client[1], FALSE))
+	test_failed(68);
+    if (check_messages(server) || server_port->blocked_list_head != NULL)
+	test_failed(68);
+
+    /* the reply blocked client, then the server */
+    if (!kill_process(client[0], FALSE) || !kill_process(server, FALSE))
+	test_failed(68);
+
+    waiter = create_process(test_kill_1_waiter, 4, 0, "Waiter")->owner;
+    resign();
+    if (waiter->state != STATE_INTR_BLOCKED
+	|| interrupt_table[TEST_KILL_1_INTR] != waiter)
+	test_failed(68);
+    if (!kill_process(waiter, FALSE) || interrupt_table[TEST_KILL_1_INTR] != NULL)
+	test_failed(68);
+
+    if (kill_process(active_proc, TRUE))
+	test_failed(68);
+}
@@ -0,0 +1,69 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the kernel log.
+ * 1. Before init_klog(), kprintf() writes to the screen right away
+ *    and appends the line to the log.
+ * 2. Output longer than KLOG_LINE_SIZE - 1 characters is cut off.
+ * 3. After init_klog(), kprintf() leaves the screen alone until the
+ *    drain runs.
+ * 4. Lines that are overwritten before the drain gets to them are
+ *    counted as lost.
+ */
+
+void test_klog_1()
+{
+    char buf[KLOG_LINE_SIZE];
+    char long_str[2 * KLOG_LINE_SIZE];
+    unsigned i;
+
+    char* expected_output_1[] = {
+	"klog 1",
+	NULL
+    };
+    char* expected_output_2[] = {
+	"drained",
+	NULL
+    };
+
+    test_reset();
+    init_interrupts();
+    init_null_process();
+
+    klog_drain = FALSE;
+    kprintf("klog %d\n", 1);
+    check_screen_output(expected_output_1);
+    if (test_result != 0)
+	test_failed(77);
+    if (!klog_read(klog_next - 1, buf) || k_strcmp(buf, "klog 1\n") != 0)
+	test_failed(77);
+
+    k_memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+    kprintf("%s", long_str);
+    if (!klog_read(klog_next - 1, buf) || k_strlen(buf) != KLOG_LINE_SIZE - 1)
+	test_failed(77);
+
+    test_reset();
+    init_interrupts();
+    init_null_process();
+    init_klog();
+
+    kprintf("drained\n");
+    if (peek_b(WINDOW_BASE_ADDR) == 'd')
+	test_failed(77);
+    while (klog_job(NULL));
+    check_screen_output(expected_output_2);
+    if (test_result != 0)
+	test_failed(77);
+
+    for (i = 0; i < KLOG_LINES + 3; i++)
+	kprintf("%d\n", i);
+    while (klog_job(NULL));
+    if (klog_lost != 3 || klog_drained != klog_next)
+	test_failed(77);
+
+    /* kprintf() writes to the screen again for the other tests */
+    klog_drain = FALSE;
+}
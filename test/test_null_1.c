@@ -0,0 +1,71 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the idle work of the null process.
+ * 1. Several processes that exit() while the null process cannot run
+ *    are all killed once it runs.
+ * 2. An idle job is called until it has no more work, and again
+ *    after kick_idle_job().
+ * 3. The canary of a stack handed out after the null process cleaned
+ *    the pool is intact.
+ */
+
+#define TEST_NULL_1_EXITS	3
+#define TEST_NULL_1_SLICES	5
+
+int test_null_1_slices;
+
+BOOL test_null_1_job(void* data)
+{
+    test_null_1_slices++;
+    return test_null_1_slices % TEST_NULL_1_SLICES != 0;
+}
+
+void test_null_1_process(PROCESS self, PARAM param)
+{
+    exit();
+}
+
+void test_null_1()
+{
+    PROCESS proc[TEST_NULL_1_EXITS];
+    PROCESS helper;
+    int i;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_null_1 ===\n");
+
+    test_null_1_slices = 0;
+    add_idle_job(test_null_1_job, NULL);
+
+    for (i = 0; i < TEST_NULL_1_EXITS; i++)
+	proc[i] = create_process(test_null_1_process, 5, 0, "Exit")->owner;
+    resign();
+    for (i = 0; i < TEST_NULL_1_EXITS; i++)
+	if (proc[i]->used != TRUE)
+	    test_failed(67);
+
+    sleep(2);
+    for (i = 0; i < TEST_NULL_1_EXITS; i++)
+	if (proc[i]->used == TRUE)
+	    test_failed(67);
+    if (test_null_1_slices != TEST_NULL_1_SLICES)
+	test_failed(67);
+
+    kick_idle_job(test_null_1_job);
+    sleep(2);
+    if (test_null_1_slices != 2 * TEST_NULL_1_SLICES)
+	test_failed(67);
+
+    /* give the null process time to clean the freed stacks */
+    sleep(20);
+    helper = create_process(test_null_1_process, 0, 0, "Canary")->owner;
+    if (stack_high_water(helper->stack_base, helper->stack_size) > 128)
+	test_failed(67);
+}
@@ -0,0 +1,64 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks try_receive() and receive_timeout().
+ * 1. try_receive() must not block when no message is waiting, and
+ *    must return a waiting message.
+ * 2. receive_timeout() must return a message that arrives before
+ *    the timeout, and cancel the timeout.
+ * 3. receive_timeout() must return NULL once the timeout expired.
+ */
+
+void test_timer_2_process(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    message((PORT) param, (void*) 7);
+    sleep(2);
+    message((PORT) param, (void*) 42);
+    receive(&sender);
+}
+
+void test_timer_2()
+{
+    PORT boot_port;
+    PROCESS sender;
+    PROCESS helper;
+    unsigned start;
+    void* data;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_2 ===\n");
+
+    boot_port = create_port();
+    helper = create_process(test_timer_2_process, 5, (PARAM) boot_port,
+			    "Helper")->owner;
+
+    data = try_receive(&sender);
+    if (data != NULL || sender != NULL)
+	test_failed(81);
+
+    /* the helper blocks on its message */
+    resign();
+    data = try_receive(&sender);
+    if (data != (void*) 7 || sender != helper)
+	test_failed(81);
+
+    /* the helper sleeps, then sends the second message */
+    data = receive_timeout(&sender, 1000);
+    if (data != (void*) 42 || sender != helper)
+	test_failed(81);
+
+    start = get_TOS_time();
+    data = receive_timeout(&sender, 3);
+    if (data != NULL || sender != NULL)
+	test_failed(81);
+    if (get_TOS_time() - start < 2)
+	test_failed(81);
+}
@@ -0,0 +1,73 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the timer wheel.
+ * 1. Processes sleeping concurrently for different numbers of ticks,
+ *    some longer than one round of the wheel, must wake up in the
+ *    order of their deadlines.
+ * 2. Timers must be recycled: many receive_timeout() calls that are
+ *    cancelled by an arriving message must not exhaust the timer pool.
+ */
+
+#define TEST_TIMER_3_SLEEPERS	10
+
+int test_timer_3_woken[TEST_TIMER_3_SLEEPERS];
+int test_timer_3_num_woken;
+
+int test_timer_3_ticks(int i)
+{
+    /* every other sleeper needs more than one round of the wheel */
+    return (i % 2 == 0) ? TEST_TIMER_3_SLEEPERS - i : 100 - i;
+}
+
+void test_timer_3_process(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    sleep(test_timer_3_ticks(param));
+    test_timer_3_woken[test_timer_3_num_woken++] = param;
+    receive(&sender);
+}
+
+void test_timer_3_sender(PROCESS self, PARAM param)
+{
+    while (1)
+	send((PORT) param, (void*) 1);
+}
+
+void test_timer_3()
+{
+    PORT boot_port;
+    PROCESS sender;
+    int i;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_3 ===\n");
+
+    test_timer_3_num_woken = 0;
+    for (i = 0; i < TEST_TIMER_3_SLEEPERS; i++)
+	create_process(test_timer_3_process, 5, i, "Sleeper");
+
+    sleep(120);
+    if (test_timer_3_num_woken != TEST_TIMER_3_SLEEPERS)
+	test_failed(82);
+    for (i = 1; i < TEST_TIMER_3_SLEEPERS; i++)
+	if (test_timer_3_ticks(test_timer_3_woken[i - 1]) >
+	    test_timer_3_ticks(test_timer_3_woken[i]))
+	    test_failed(82);
+
+    /* the sender only runs while we wait in receive_timeout() */
+    boot_port = create_port();
+    create_process(test_timer_3_sender, 1, (PARAM) boot_port, "Sender");
+    for (i = 0; i < 3 * MAX_PROCS; i++) {
+	if (receive_timeout(&sender, 1000) != (void*) 1 || sender == NULL)
+	    test_failed(82);
+	reply(sender);
+    }
+}
@@ -0,0 +1,50 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks init_pit() and get_time_us().
+ * 1. get_time_us() must never go backwards.
+ * 2. After init_pit(100), a sleep of 50 ms must take at least 50 ms
+ *    and not much more than that, measured with get_time_us().
+ * 3. ms_to_ticks() must round up to whole ticks.
+ */
+
+void test_timer_4()
+{
+    unsigned start;
+    unsigned last;
+    unsigned now;
+    int i;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_4 ===\n");
+
+    init_pit(100);
+    if (timer_hz != 100)
+	test_failed(83);
+    if (ms_to_ticks(50) != 5 || ms_to_ticks(51) != 6 || ms_to_ticks(-1) != 0)
+	test_failed(83);
+
+    last = get_time_us();
+    for (i = 0; i < 10000; i++) {
+	now = get_time_us();
+	if (now - last > 1000000)
+	    test_failed(83);
+	last = now;
+    }
+
+    sleep(1);
+    start = get_time_us();
+    sleep(ms_to_ticks(50));
+    now = get_time_us();
+    if (now - start < 49000 || now - start > 70000)
+	test_failed(83);
+
+    /* back to the BIOS rate for the other tests */
+    init_pit(18);
+}
@@ -0,0 +1,55 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks sleep_until() and periodic timers.
+ * 1. sleep_until() must return at the requested tick, and right away
+ *    (with the next tick) for a tick that already passed.
+ * 2. A periodic timer must expire every period ticks, relative to its
+ *    previous deadline.
+ * 3. wait_periodic() must not block if the caller fell behind, and
+ *    report the number of missed periods.
+ */
+
+void test_timer_5()
+{
+    TIMER timer;
+    unsigned start;
+    unsigned now;
+    int i;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_5 ===\n");
+
+    start = get_TOS_time();
+    sleep_until(start + 5);
+    now = get_TOS_time();
+    if (now < start + 5 || now > start + 6)
+	test_failed(84);
+
+    sleep_until(now - 3);
+    if (get_TOS_time() - now > 2)
+	test_failed(84);
+
+    /* start right after a tick */
+    sleep(1);
+    start = get_TOS_time();
+    timer = periodic_timer(3);
+    for (i = 1; i <= 4; i++) {
+	if (wait_periodic(timer) != 1)
+	    test_failed(84);
+	if (get_TOS_time() != start + 3 * i)
+	    test_failed(84);
+    }
+
+    /* fall behind by two periods */
+    while (get_TOS_time() < start + 3 * 6);
+    if (wait_periodic(timer) != 2)
+	test_failed(84);
+    cancel_periodic(timer);
+}
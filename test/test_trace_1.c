@@ -0,0 +1,74 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the kernel event trace.
+ * 1. Nothing is recorded while tracing is off.
+ * 2. A send/receive/reply round trip records the send, the dispatch
+ *    of the receiver, the receive and the reply, in this order and
+ *    with increasing time stamps.
+ */
+
+void test_trace_1_process(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    while (1) {
+	receive(&sender);
+	reply(sender);
+    }
+}
+
+int test_trace_1_find(int event, int from)
+{
+    int i;
+
+    for (i = from; i < trace_next; i++)
+	if (trace_buffer[i].event == event)
+	    return i;
+    test_failed(66);
+    return -1;
+}
+
+void test_trace_1()
+{
+    PORT server_port;
+    PROCESS server;
+    int sent, dispatched, received, replied;
+    int i;
+
+    test_reset();
+
+    kprintf("=== test_trace_1 ===\n");
+
+    server_port = create_process(test_trace_1_process, 5, 0, "Server");
+    server = server_port->owner;
+    resign();
+
+    trace_start();
+    trace_stop();
+    send(server_port, NULL);
+    if (trace_next != 0)
+	test_failed(66);
+
+    trace_start();
+    send(server_port, (void*) 1);
+    trace_stop();
+
+    sent = test_trace_1_find(TRACE_SEND, 0);
+    if (trace_buffer[sent].proc != 0 || trace_buffer[sent].arg != server_port - port)
+	test_failed(66);
+    dispatched = test_trace_1_find(TRACE_DISPATCH, sent);
+    if (trace_buffer[dispatched].arg != server - pcb)
+	test_failed(66);
+    received = test_trace_1_find(TRACE_RECEIVE, dispatched);
+    if (trace_buffer[received].proc != server - pcb || trace_buffer[received].arg != 0)
+	test_failed(66);
+    replied = test_trace_1_find(TRACE_REPLY, received);
+    if (trace_buffer[replied].arg != 0)
+	test_failed(66);
+
+    for (i = 1; i < trace_next; i++)
+	if (trace_buffer[i].tsc < trace_buffer[i - 1].tsc)
+	    test_failed(66);
+}
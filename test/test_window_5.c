@@ -0,0 +1,99 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the bulk path of output_string().
+ * 1. The same text goes to two windows of the same size, to one with
+ *    output_char() and to the other one with output_string(). The text
+ *    has tabs, newlines, wraps at the end of a line and scrolls. Both
+ *    windows must look the same, also after remove_char().
+ * 2. TEST_WINDOW_5_LINES lines are printed with output_char() and with
+ *    output_string(), and the number of characters per second is
+ *    printed.
+ */
+
+#define TEST_WINDOW_5_LINES	200
+
+static char test_window_5_text[] =
+    "Hello\tworld\n"
+    "a line that is too long for the window\n"
+    "\t\ttabs\t\n"
+    "\n"
+    "abcdefghijklmnopqrstuvwxyz0123456789 end\t";
+
+BOOL test_window_5_same(WINDOW* a, WINDOW* b)
+{
+    int x, y;
+
+    if (a->cursor_x != b->cursor_x || a->cursor_y != b->cursor_y)
+	return FALSE;
+    for (y = 0; y < a->height; y++)
+	for (x = 0; x < a->width; x++)
+	    if (peek_w(WINDOW_BASE_ADDR + 2 * WINDOW_OFFSET(a, x, y)) !=
+		peek_w(WINDOW_BASE_ADDR + 2 * WINDOW_OFFSET(b, x, y)))
+		return FALSE;
+    return TRUE;
+}
+
+void test_window_5()
+{
+    WINDOW char_window = {0, 2, 17, 6, 0, 0, '_'};
+    WINDOW string_window = {40, 2, 17, 6, 0, 0, '_'};
+    WINDOW bench_window = {0, 10, 80, 12, 0, 0, ' '};
+    char line[81];
+    unsigned start, char_ms, string_ms;
+    char* p;
+    int i;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+    init_pit(100);
+
+    kprintf("=== test_window_5 ===\n");
+
+    clear_window(&char_window);
+    clear_window(&string_window);
+    for (i = 0; i < 3; i++) {
+	for (p = test_window_5_text; *p != '\0'; p++)
+	    output_char(&char_window, *p);
+	output_string(&string_window, test_window_5_text);
+    }
+    if (!test_window_5_same(&char_window, &string_window))
+	test_failed(75);
+
+    for (i = 0; i < 3; i++) {
+	remove_char(&char_window);
+	remove_char(&string_window);
+    }
+    if (!test_window_5_same(&char_window, &string_window))
+	test_failed(75);
+
+    for (i = 0; i < 79; i++)
+	line[i] = 'a' + i % 26;
+    line[79] = '\n';
+    line[80] = '\0';
+
+    clear_window(&bench_window);
+    start = get_time_us();
+    for (i = 0; i < TEST_WINDOW_5_LINES; i++)
+	for (p = line; *p != '\0'; p++)
+	    output_char(&bench_window, *p);
+    char_ms = max((get_time_us() - start) / 1000, 1);
+
+    clear_window(&bench_window);
+    start = get_time_us();
+    for (i = 0; i < TEST_WINDOW_5_LINES; i++)
+	output_string(&bench_window, line);
+    string_ms = max((get_time_us() - start) / 1000, 1);
+
+    kprintf("output_char():   %u chars/s\n",
+	    TEST_WINDOW_5_LINES * 80 * 1000 / char_ms);
+    kprintf("output_string(): %u chars/s\n",
+	    TEST_WINDOW_5_LINES * 80 * 1000 / string_ms);
+
+    /* back to the BIOS rate for the other tests */
+    init_pit(18);
+}
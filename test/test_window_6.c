@@ -0,0 +1,42 @@
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * This test checks the colours of a window.
+ * 1. A window with a style is cleared in that style.
+ * 2. ANSI colour escapes in wprintf() change the attribute of the
+ *    following characters, ESC [ 0 m goes back to the style. Other
+ *    escapes are skipped.
+ * 3. Scrolling keeps the attributes.
+ */
+
+BOOL test_window_6_check(int x, int y, char ch, unsigned char attr)
+{
+    MEM_ADDR position = WINDOW_BASE_ADDR + 2 * (y * WINDOW_TOTAL_WIDTH + x);
+
+    return peek_b(position) == ch && peek_b(position + 1) == attr;
+}
+
+void test_window_6()
+{
+    WINDOW test_window = {0, 2, 20, 3, 0, 0, ' ', 0x1F, 0};
+
+    test_reset();
+
+    clear_window(&test_window);
+    if (!test_window_6_check(5, 3, ' ', 0x1F))
+	test_failed(76);
+
+    wprintf(&test_window, "\n%c\033[31m%c\033[1;42m%c\033[0m%c\033[2J%c\n\n",
+	    'a', 'b', 'c', 'd', 'e');
+
+    /* the line moved up from the second to the first line of the window */
+    if (!test_window_6_check(0, 2, 'a', 0x1F)
+	|| !test_window_6_check(1, 2, 'b', 0x1C)
+	|| !test_window_6_check(2, 2, 'c', 0x2C)
+	|| !test_window_6_check(3, 2, 'd', 0x1F)
+	|| !test_window_6_check(4, 2, 'e', 0x1F))
+	test_failed(76);
+    if (test_window.attr != 0)
+	test_failed(76);
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+
+# Converts a kernel event trace, as sent to COM2 by the shell command
+# 'trace dump', to the Chrome trace event format. Load the result in
+# chrome://tracing or https://ui.perfetto.dev.
+#
+# usage: trace2json.py capture.bin > trace.json
+#
+# The capture may contain other output before the trace; everything
+# up to the "TOSTRACE" magic is skipped. See kernel/trace.c for the
+# format.
+
+import json, struct, sys
+
+TRACE_VERSION = 1
+
+EVENTS = {
+    1: "dispatch",
+    2: "interrupt",
+    3: "send",
+    4: "message",
+    5: "receive",
+    6: "reply",
+    7: "timer",
+}
+
+TIMER_TYPES = {0: "sleep", 1: "timeout", 2: "periodic"}
+
+
+def read_trace(data):
+    pos = data.find(b"TOSTRACE")
+    if pos < 0:
+        sys.exit("no trace found")
+    pos += 8
+
+    version, count = struct.unpack_from("<II", data, pos)
+    pos += 8
+    if version != TRACE_VERSION:
+        sys.exit("unknown trace version %d" % version)
+    start_tsc, start_us, end_tsc, end_us = struct.unpack_from("<QIQI", data, pos)
+    pos += 24
+
+    records = []
+    for i in range(count):
+        records.append(struct.unpack_from("<QBBHI", data, pos))
+        pos += 16
+
+    names = {}
+    (num_procs,) = struct.unpack_from("<I", data, pos)
+    pos += 4
+    for i in range(num_procs):
+        index, length = struct.unpack_from("<BB", data, pos)
+        pos += 2
+        names[index] = data[pos:pos + length].decode("ascii", "replace")
+        pos += length
+
+    # TSC ticks per microsecond, measured against the PIT
+    elapsed_us = (end_us - start_us) & 0xFFFFFFFF
+    if elapsed_us == 0:
+        sys.exit("trace too short to calibrate the TSC")
+    tsc_per_us = float(end_tsc - start_tsc) / elapsed_us
+
+    return records, names, start_tsc, tsc_per_us
+
+
+def to_chrome(records, names, start_tsc, tsc_per_us):
+    events = []
+
+    def name_of(proc):
+        return names.get(proc, "process %d" % proc)
+
+    for proc, name in names.items():
+        events.append({"name": "thread_name", "ph": "M", "pid": 0,
+                       "tid": proc, "args": {"name": "%d %s" % (proc, name)}})
+
+    running = None      # (process, start time) of the current slice
+    for tsc, event, proc, arg, data in records:
+        ts = (tsc - start_tsc) / tsc_per_us
+        kind = EVENTS.get(event, "event %d" % event)
+
+        if event == 1:
+            # a dispatch ends the slice of proc and starts one of arg
+            if running is not None and running[0] == proc:
+                events.append({"name": name_of(proc), "ph": "X", "pid": 0,
+                               "tid": proc, "ts": running[1],
+                               "dur": ts - running[1]})
+            running = (arg, ts)
+            continue
+
+        if event == 2:
+            args = {"vector": "0x%x" % arg}
+        elif event in (3, 4):
+            args = {"port": arg, "length": data}
+        elif event == 5:
+            args = {"sender": name_of(arg), "port": data}
+        elif event == 6:
+            args = {"to": name_of(arg)}
+        elif event == 7:
+            args = {"owner": name_of(arg), "type": TIMER_TYPES.get(data, data)}
+        else:
+            args = {"arg": arg, "data": data}
+
+        events.append({"name": kind, "ph": "i", "s": "t", "pid": 0,
+                       "tid": proc, "ts": ts, "args": args})
+
+    return {"traceEvents": events}
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s capture.bin > trace.json" % sys.argv[0])
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    json.dump(to_chrome(*read_trace(data)), sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()